@@ -1,5 +1,5 @@
-file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/getDistParamError.p DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Debug)
-file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/getDistParamError.p DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Release)
+file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/getDistParamError.m DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Debug)
+file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/getDistParamError.m DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Release)
 
-file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/GetFMin.p DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Debug)
-file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/GetFMin.p DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Release)
+file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/GetFMin.m DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Debug)
+file(COPY ${CMAKE_CURRENT_SOURCE_DIR}/fmin/GetFMin.m DESTINATION ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/Release)
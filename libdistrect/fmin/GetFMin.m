@@ -1,9 +1,31 @@
-function result = GetFMin(I, lineGroups)
+function result = GetFMin(imageSize, lineGroups, x0, model, scale)
 
-% find the distortion parameters
-funToSolve = @(x)getDistParamError(x, I, lineGroups);
-[kParams, error] = fminsearch(funToSolve, [0;0]);
+% imageSize is [rows cols], only the image center enters the cost
 
-result = [kParams; error];
+% start from the caller's estimate when there is one
+if nargin < 3
+    x0 = [0;0];
+end
+% 0 = polynomial (OpenCV k1/k2), 1 = division model
+if nargin < 4
+    model = 0;
+end
+% search k1 * scale^2 and k2 * scale^4 instead of k1/k2 in pixels, so
+% that the relative initial simplex and the absolute TolX of fminsearch
+% fit coefficients of order one instead of 1e-7
+if nargin < 5
+    scale = 1;
+end
+units = scale .^ (2 * (1:length(x0))');
 
-end
\ No newline at end of file
+% find the distortion parameters, x0 may hold k1 only
+funToSolve = @(x)getDistParamError(x ./ units, imageSize, lineGroups, model);
+[kParams, error, ~, output] = fminsearch(funToSolve, x0 .* units);
+kParams = kParams ./ units;
+if length(kParams) < 2
+    kParams(2, 1) = 0;
+end
+
+result = [kParams; error; output.funcCount];
+
+end
@@ -1,8 +1,14 @@
-function error = getDistParamError(kParams, I, lineGroups)
+function error = getDistParamError(kParams, imageSize, lineGroups, model)
 
-params = struct('fx',1, 'fy', 1, 'cx', size(I, 2) / 2, 'cy', size(I, 1) / 2, 'k1', 0, 'k2', 0, 'k3', 0, 'p1', 0, 'p2', 0);
+if nargin < 4
+    model = 0;
+end
+
+params = struct('fx',1, 'fy', 1, 'cx', imageSize(2) / 2, 'cy', imageSize(1) / 2, 'k1', 0, 'k2', 0, 'k3', 0, 'p1', 0, 'p2', 0, 'model', model);
 params.k1 = kParams(1);
-params.k2 = kParams(2);
+if length(kParams) > 1
+    params.k2 = kParams(2);
+end
 
 lineGroups = undistortLineGroups(lineGroups, params);
 error = gradeLineGroups(lineGroups);
@@ -37,6 +43,15 @@ x2 = hpts(1,:);
 y2 = hpts(2,:);
 r2 = sqrt(x2.^2 + y2.^2);
 
+% the division model undistorts in closed form
+if params.model == 1
+    d = 1 + k1*r2.^2 + k2*r2.^4;
+    pts(:, 1) = (x2 ./ d) * fx + cx;
+    pts(:, 2) = (y2 ./ d) * fy + cy;
+    outLineGroup = [pts(1:noLines,:) pts(noLines + 1:noLines * 2, :)];
+    return;
+end
+
 iterations = 10;
 
 r = r2;
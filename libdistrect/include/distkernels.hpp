@@ -0,0 +1,349 @@
+#ifndef DISTKERNELS_HPP
+#define DISTKERNELS_HPP
+
+#include <libdistrect.hpp>
+
+namespace distrect
+{
+namespace kernels
+{
+
+	// k1 * r2 + k2 * r2^2 with the number of active coefficients fixed at
+	// compile time.
+	template <class _T, int _NumParams>
+	struct RadialPolynomial;
+
+	template <class _T>
+	struct RadialPolynomial<_T, 1>
+	{
+		static inline _T eval(_T r2, const _T *k)
+		{
+			return k[0] * r2;
+		}
+
+		// derivative w.r.t. r of r * (1 + eval(r^2))
+		static inline _T slope(_T r2, const _T *k)
+		{
+			return _T(1) + _T(3) * k[0] * r2;
+		}
+	};
+
+	template <class _T>
+	struct RadialPolynomial<_T, 2>
+	{
+		static inline _T eval(_T r2, const _T *k)
+		{
+			return r2 * (k[0] + k[1] * r2);
+		}
+
+		static inline _T slope(_T r2, const _T *k)
+		{
+			return _T(1) + r2 * (_T(3) * k[0] + _T(5) * k[1] * r2);
+		}
+	};
+
+	// radial scales of a model. undistortScale takes the squared distorted
+	// radius, distortScale the squared undistorted one.
+	template <class _T, distortion_model _Model, int _NumParams>
+	struct RadialModel;
+
+	template <class _T, int _NumParams>
+	struct RadialModel<_T, DIST_MODEL_POLYNOMIAL, _NumParams>
+	{
+		static inline _T undistortScale(_T rd2, const _T *k)
+		{
+			_T rd = std::sqrt(rd2);
+			_T r = rd;
+			for (int i = 0; i < NEWTON_ITERATIONS; i++)
+			{
+				_T r2 = r * r;
+				r = r - (r * (_T(1) + RadialPolynomial<_T, _NumParams>::eval(r2, k)) - rd) / RadialPolynomial<_T, _NumParams>::slope(r2, k);
+			}
+			return _T(1) / (_T(1) + RadialPolynomial<_T, _NumParams>::eval(r * r, k));
+		}
+
+		static inline _T distortScale(_T ru2, const _T *k)
+		{
+			return _T(1) + RadialPolynomial<_T, _NumParams>::eval(ru2, k);
+		}
+	};
+
+	template <class _T, int _NumParams>
+	struct RadialModel<_T, DIST_MODEL_DIVISION, _NumParams>
+	{
+		static inline _T undistortScale(_T rd2, const _T *k)
+		{
+			return _T(1) / (_T(1) + RadialPolynomial<_T, _NumParams>::eval(rd2, k));
+		}
+
+		static inline _T distortScale(_T ru2, const _T *k)
+		{
+			// closed form root of the one parameter model. unreachable radii
+			// get a huge scale, which sends them outside the source image.
+			_T disc = _T(1) - _T(4) * k[0] * ru2;
+			_T scale = (disc >= _T(0)) ? _T(2) / (_T(1) + std::sqrt(disc)) : _T(1e6);
+			if (_NumParams > 1)
+			{
+				// refine rd = ru * scale on ru * (1 + k1 rd^2 + k2 rd^4) = rd
+				for (int i = 0; i < DIVISION_INVERSE_ITERATIONS; i++)
+				{
+					_T s2 = scale * scale * ru2;
+					_T f = _T(1) + RadialPolynomial<_T, _NumParams>::eval(s2, k) - scale;
+					_T df = _T(2) * scale * ru2 * (k[0] + _T(2) * k[_NumParams - 1] * s2) - _T(1);
+					scale = scale - f / df;
+				}
+			}
+			return scale;
+		}
+	};
+
+	template <class _T>
+	struct lens_t
+	{
+		_T fx, fy, cx, cy;
+		_T k[2];
+	};
+
+	template <class _T>
+	inline lens_t<_T> getLens(const camera_props &props)
+	{
+		lens_t<_T> lens;
+		lens.fx = _T(props.intrinsic_matrix.at<float>(0, 0));
+		lens.fy = _T(props.intrinsic_matrix.at<float>(1, 1));
+		lens.cx = _T(props.intrinsic_matrix.at<float>(0, 2));
+		lens.cy = _T(props.intrinsic_matrix.at<float>(1, 2));
+		lens.k[0] = _T(props.distortion_params.at<float>(0, 0));
+		lens.k[1] = _T(props.distortion_params.at<float>(0, 1));
+		return lens;
+	}
+
+	template <class _T>
+	inline lens_t<_T> getNewLens(const cv::Mat &newCameraMatrix)
+	{
+		cv::Mat newCamMat;
+		newCameraMatrix.convertTo(newCamMat, CV_64F);
+		lens_t<_T> lens;
+		lens.fx = _T(newCamMat.at<double>(0, 0));
+		lens.fy = _T(newCamMat.at<double>(1, 1));
+		lens.cx = _T(newCamMat.at<double>(0, 2));
+		lens.cy = _T(newCamMat.at<double>(1, 2));
+		lens.k[0] = lens.k[1] = _T(0);
+		return lens;
+	}
+
+	/**
+	* lineGroupsErrorKernel
+	*
+	* Cost of `getLineGroupsError` on packed lines (sx, sy, ex, ey).
+	* `groupEnds` holds the cumulative line count of every group and
+	* `angles` must have room for the largest group.
+	*/
+	template <class _T, distortion_model _Model, int _NumParams>
+	double lineGroupsErrorKernel(const _T *lines, const int *groupEnds, int numGroups, const lens_t<_T> &lens, _T *angles)
+	{
+		typedef RadialModel<_T, _Model, _NumParams> Model;
+		const _T invFx = _T(1) / lens.fx;
+		const _T invFy = _T(1) / lens.fy;
+		const _T degPerRad = _T(RAD_TO_DEG_MULT);
+
+		double totalError = 0.0;
+		int groupStart = 0;
+		for (int g = 0; g < numGroups; g++)
+		{
+			int noLines = groupEnds[g] - groupStart;
+			for (int i = 0; i < noLines; i++)
+			{
+				const _T *line = lines + 4 * (groupStart + i);
+				_T sx = (line[0] - lens.cx) * invFx;
+				_T sy = (line[1] - lens.cy) * invFy;
+				_T ex = (line[2] - lens.cx) * invFx;
+				_T ey = (line[3] - lens.cy) * invFy;
+				_T ss = Model::undistortScale(sx * sx + sy * sy, lens.k);
+				_T es = Model::undistortScale(ex * ex + ey * ey, lens.k);
+				angles[i] = degPerRad * std::atan2((ey * es - sy * ss) * lens.fy, (ex * es - sx * ss) * lens.fx);
+			}
+
+			_T groupError = _T(0);
+			for (int j = 0; j < noLines; j++)
+			{
+				for (int k = j + 1; k < noLines; k++)
+				{
+					_T diff = std::abs(angles[j] - angles[k]);
+					diff = std::min(diff, _T(360) - diff);
+					groupError += diff * diff;
+				}
+			}
+
+			totalError += double(groupError) / (noLines * (noLines - 1) / 2);
+			groupStart = groupEnds[g];
+		}
+
+		return totalError / numGroups;
+	}
+
+	/**
+	* mapRowsKernel
+	*
+	* Source coordinates of the output rows [rowStart, rowEnd), as
+	* `getRectifyMapRows` returns them.
+	*/
+	template <class _T, distortion_model _Model, int _NumParams>
+	void mapRowsKernel(const lens_t<_T> &lens, const lens_t<_T> &newLens, int rowStart, int rowEnd, cv::Mat &mapX, cv::Mat &mapY)
+	{
+		typedef RadialModel<_T, _Model, _NumParams> Model;
+		const _T invFx = _T(1) / newLens.fx;
+		const _T invFy = _T(1) / newLens.fy;
+
+		for (int row = rowStart; row < rowEnd; row++)
+		{
+			float *mapXRow = mapX.ptr<float>(row - rowStart);
+			float *mapYRow = mapY.ptr<float>(row - rowStart);
+			_T y = (_T(row) - newLens.cy) * invFy;
+			_T y2 = y * y;
+			for (int col = 0; col < mapX.cols; col++)
+			{
+				_T x = (_T(col) - newLens.cx) * invFx;
+				_T scale = Model::distortScale(x * x + y2, lens.k);
+				mapXRow[col] = float(x * scale * lens.fx + lens.cx);
+				mapYRow[col] = float(y * scale * lens.fy + lens.cy);
+			}
+		}
+	}
+
+	/**
+	* remapRowsKernel
+	*
+	* Rectifies the output rows [rowStart, rowEnd) of `dst` straight
+	* from the model, sampling `src` bilinearly with a constant zero
+	* border like `cv::remap`. No map is stored.
+	*/
+	template <class _Pixel, int _Cn, class _T, distortion_model _Model, int _NumParams>
+	void remapRowsKernel(const cv::Mat &src, cv::Mat &dst, const lens_t<_T> &lens, const lens_t<_T> &newLens, int rowStart, int rowEnd)
+	{
+		typedef RadialModel<_T, _Model, _NumParams> Model;
+		const _T invFx = _T(1) / newLens.fx;
+		const _T invFy = _T(1) / newLens.fy;
+		const int lastX = src.cols - 1;
+		const int lastY = src.rows - 1;
+		const _T srcCols = _T(src.cols);
+		const _T srcRows = _T(src.rows);
+		const size_t srcStep = src.step[0] / sizeof(_Pixel);
+		const _Pixel *srcData = src.ptr<_Pixel>(0);
+
+		for (int row = rowStart; row < rowEnd; row++)
+		{
+			_Pixel *dstRow = dst.ptr<_Pixel>(row);
+			_T y = (_T(row) - newLens.cy) * invFy;
+			_T y2 = y * y;
+			for (int col = 0; col < dst.cols; col++)
+			{
+				_T x = (_T(col) - newLens.cx) * invFx;
+				_T scale = Model::distortScale(x * x + y2, lens.k);
+				_T sx = std::min(std::max(x * scale * lens.fx + lens.cx, _T(-1)), srcCols);
+				_T sy = std::min(std::max(y * scale * lens.fy + lens.cy, _T(-1)), srcRows);
+
+				// clamp instead of branching, each of the four neighbours
+				// outside the image gets zero weight, so the last row and
+				// column are still blended with the border
+				int x0 = int(std::floor(sx));
+				int y0 = int(std::floor(sy));
+				_T inX0 = _T((x0 >= 0) & (x0 <= lastX));
+				_T inX1 = _T((x0 >= -1) & (x0 < lastX));
+				_T inY0 = _T((y0 >= 0) & (y0 <= lastY));
+				_T inY1 = _T((y0 >= -1) & (y0 < lastY));
+				_T ax = sx - _T(x0);
+				_T ay = sy - _T(y0);
+
+				const _Pixel *row0 = srcData + std::min(std::max(y0, 0), lastY) * srcStep;
+				const _Pixel *row1 = srcData + std::min(std::max(y0 + 1, 0), lastY) * srcStep;
+				int col0 = std::min(std::max(x0, 0), lastX) * _Cn;
+				int col1 = std::min(std::max(x0 + 1, 0), lastX) * _Cn;
+				for (int c = 0; c < _Cn; c++)
+				{
+					_T p00 = inY0 * inX0 * _T(row0[col0 + c]);
+					_T p01 = inY0 * inX1 * _T(row0[col1 + c]);
+					_T p10 = inY1 * inX0 * _T(row1[col0 + c]);
+					_T p11 = inY1 * inX1 * _T(row1[col1 + c]);
+					_T top = p00 + ax * (p01 - p00);
+					_T bottom = p10 + ax * (p11 - p10);
+					dstRow[col * _Cn + c] = cv::saturate_cast<_Pixel>(top + ay * (bottom - top));
+				}
+			}
+		}
+	}
+
+} // namespace kernels
+
+	typedef double (*cost_kernel_f)(const float *, const int *, int, const kernels::lens_t<float> &, float *);
+	typedef double (*cost_kernel_d)(const double *, const int *, int, const kernels::lens_t<double> &, double *);
+	typedef void (*map_kernel)(const kernels::lens_t<float> &, const kernels::lens_t<float> &, int, int, cv::Mat &, cv::Mat &);
+	typedef void (*remap_kernel)(const cv::Mat &, cv::Mat &, const kernels::lens_t<float> &, const kernels::lens_t<float> &, int, int);
+
+	/**
+	* selectCostKernel / selectMapKernel / selectRemapKernel
+	*
+	* Functions to pick the specialization for a model, a number of
+	* active coefficients and, for remap, a `cv::Mat` type (8U, 16U or
+	* 32F with 1 or 3 channels, nullptr for any other type). Call them
+	* once at setup.
+	*/
+	cost_kernel_f selectCostKernelF(distortion_model, int);
+	cost_kernel_d selectCostKernelD(distortion_model, int);
+	map_kernel selectMapKernel(distortion_model, int);
+	remap_kernel selectRemapKernel(int, distortion_model, int);
+
+	/**
+	* getActiveParamCount
+	*
+	* Function to get the number of non zero distortion coefficients, at least 1.
+	*/
+	inline int getActiveParamCount(const camera_props &props)
+	{
+		return (props.distortion_params.at<float>(0, 1) != 0.0f) ? 2 : 1;
+	}
+
+	class CostEvaluator
+	{
+	public:
+		/**
+		* CostEvaluator
+		*
+		* Packs the line groups and selects the cost kernel once, so
+		* that every evaluation is a single call without dispatch.
+		* Groups with less than two lines are dropped.
+		*
+		* Args:
+		*  groups(LineSegmentList): selected line groups.
+		*  props(camera_props): intrinsics and model, the coefficients are ignored.
+		*  numParams(int): number of active coefficients, 1 or 2.
+		*  useFloat(bool): evaluate in float32 instead of double.
+		*/
+		CostEvaluator(const LineSegmentList &, const camera_props &, int numParams = 2, bool useFloat = false);
+		virtual ~CostEvaluator();
+
+		/**
+		* evaluate
+		*
+		* Function to get the `getLineGroupsError` cost for k1/k2.
+		* Not thread safe, use one evaluator per thread.
+		*/
+		double evaluate(double, double) const;
+		int getGroupCount() const;
+
+	private:
+		std::vector<float> m_linesF;
+		std::vector<double> m_linesD;
+		std::vector<int> m_groupEnds;
+		mutable std::vector<float> m_anglesF;
+		mutable std::vector<double> m_anglesD;
+		mutable kernels::lens_t<float> m_lensF;
+		mutable kernels::lens_t<double> m_lensD;
+		cost_kernel_f m_kernelF;
+		cost_kernel_d m_kernelD;
+		int m_numParams;
+		bool m_useFloat;
+	};
+
+} // namespace distrect
+
+#endif //DISTKERNELS_HPP
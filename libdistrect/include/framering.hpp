@@ -0,0 +1,190 @@
+#ifndef FRAMERING_HPP
+#define FRAMERING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+namespace distrect
+{
+
+	const uint32_t FRAME_RING_MAGIC = 0x47525244; // "DRRG"
+	const uint32_t FRAME_RING_VERSION = 2;
+	const int FRAME_RING_SLOTS = 8;
+	const size_t FRAME_RING_ALIGN = 64;
+
+	// layout of the shared region: one ring_header, then `slotCount` slots
+	// of `slotStride` bytes, each a ring_slot_header followed by the pixels.
+	typedef struct ring_header_t
+	{
+		uint32_t magic, version;
+		uint32_t slotCount;
+		int32_t rows, cols, type;
+		// process id of the producer, to tell a left behind region
+		uint32_t ownerPid;
+		uint64_t slotStride, dataOffset, dataBytes;
+		// sequence number of the last published frame, 0 if none yet
+		std::atomic<uint64_t> published;
+	} ring_header;
+
+	typedef struct ring_slot_header_t
+	{
+		// seqlock, odd while the producer writes the slot
+		std::atomic<uint64_t> version;
+		uint64_t sequence;
+		int64_t timestamp;
+	} ring_slot_header;
+
+	typedef struct frame_view_t
+	{
+		cv::Mat image;
+		uint64_t sequence;
+		int64_t timestamp;
+		// slot lock version the view was taken at
+		uint64_t version;
+	} frame_view;
+
+	class SharedMemoryRegion
+	{
+	public:
+		/**
+		* SharedMemoryRegion
+		*
+		* Named shared memory mapping, POSIX `shm_open` or a Win32 file
+		* mapping. The creator owns the name and removes it on destruction.
+		* Creating fails while another producer holds the name. On POSIX
+		* a frame ring left behind by a producer that is gone, e.g. one
+		* that crashed, is replaced; a Win32 mapping disappears with its
+		* last handle.
+		*
+		* Args:
+		*  name(std::string): region name, e.g. "/distrect_cam0".
+		*  size(size_t): bytes to create, 0 to open the whole existing region.
+		*  create(bool): create the region instead of opening it.
+		*/
+		SharedMemoryRegion(const std::string &, size_t, bool);
+		virtual ~SharedMemoryRegion();
+
+		uint8_t *data();
+		size_t size();
+
+	private:
+		SharedMemoryRegion(const SharedMemoryRegion &);
+		SharedMemoryRegion &operator=(const SharedMemoryRegion &);
+
+		std::string m_name;
+		size_t m_size;
+		uint8_t *m_data;
+		bool m_owner;
+		void *m_handle;
+	};
+
+	class FrameRingWriter
+	{
+	public:
+		/**
+		* FrameRingWriter
+		*
+		* Single producer side of a ring of fixed size frame slots.
+		*
+		* Args:
+		*  name(std::string): shared memory name.
+		*  size(cv::Size): frame size.
+		*  type(int): frame type, e.g. CV_8UC3.
+		*  slotCount(int): number of slots. default 8.
+		*/
+		FrameRingWriter(const std::string &, cv::Size, int, int slotCount = FRAME_RING_SLOTS);
+		virtual ~FrameRingWriter();
+
+		/**
+		* beginWrite
+		*
+		* Function to get the next slot as a `cv::Mat` header over the
+		* shared memory, e.g. as the output of `undistort`. Readers
+		* ignore the slot until `commit` is called.
+		*
+		* Ret:
+		*  image(cv::Mat): writable slot, valid until `commit`.
+		*/
+		cv::Mat beginWrite();
+
+		/**
+		* commit
+		*
+		* Function to publish the slot returned by `beginWrite`.
+		*
+		* Args:
+		*  timestamp(int64_t): caller defined timestamp stored with the frame.
+		*
+		* Ret:
+		*  sequence(uint64_t): sequence number of the published frame.
+		*/
+		uint64_t commit(int64_t timestamp = 0);
+
+	private:
+		SharedMemoryRegion m_region;
+		ring_header *m_header;
+		uint64_t m_nextSequence;
+		bool m_writing;
+	};
+
+	class FrameRingReader
+	{
+	public:
+		/**
+		* FrameRingReader
+		*
+		* Consumer side, any number of readers may attach. Readers never
+		* write to the shared memory and never block the producer.
+		*
+		* Args:
+		*  name(std::string): shared memory name used by the producer.
+		*/
+		FrameRingReader(const std::string &);
+		virtual ~FrameRingReader();
+
+		/**
+		* getPublishedSequence
+		*
+		* Function to get the sequence number of the last published frame, 0 if none.
+		*/
+		uint64_t getPublishedSequence();
+
+		/**
+		* acquire
+		*
+		* Function to get a zero-copy view of a published frame. The
+		* producer may overwrite the slot at any time, so call
+		* `validate` once done with the view and discard the results
+		* if it fails.
+		*
+		* Args:
+		*  sequence(uint64_t): frame to be read, 0 for the latest one.
+		*  view(frame_view): output view.
+		*
+		* Ret:
+		*  ok(bool): false if the frame isn't available (anymore).
+		*/
+		bool acquire(uint64_t, frame_view &);
+		bool validate(const frame_view &);
+
+		/**
+		* read
+		*
+		* Function to copy a published frame out of the ring.
+		* The copy is validated, retrying with the latest frame if the
+		* slot was overwritten meanwhile when `sequence` is 0.
+		*/
+		bool read(uint64_t, frame_view &);
+
+	private:
+		SharedMemoryRegion m_region;
+		ring_header *m_header;
+
+		ring_slot_header *mGetSlot(uint64_t);
+	};
+
+} // namespace distrect
+
+#endif //FRAMERING_HPP
@@ -0,0 +1,105 @@
+#ifndef JOINTCALIB_HPP
+#define JOINTCALIB_HPP
+
+#include <distkernels.hpp>
+
+namespace distrect
+{
+
+	class JointCalibrator
+	{
+	public:
+		/**
+		* JointCalibrator
+		*
+		* Estimates one set of k1/k2 for many images of the same lens.
+		* The selected line groups of all images are pooled into a
+		* single objective, the mean `getLineGroupsError` over every
+		* group, minimized natively with Nelder-Mead like `GetFMin`.
+		* Each evaluation is sharded across threads per image and the
+		* per-image costs are reduced weighted by their group counts.
+		*
+		* Args:
+		*  model(distortion_model): default DIST_MODEL_POLYNOMIAL.
+		*  numParams(int): 1 to estimate k1 only, 2 for k1 and k2.
+		*/
+		JointCalibrator(distortion_model model = DIST_MODEL_POLYNOMIAL, int numParams = 2);
+		virtual ~JointCalibrator();
+
+		/**
+		* addImage
+		*
+		* Function to add the selected line groups of an image. All
+		* images must have the same size.
+		*
+		* Args:
+		*  groups(LineSegmentList): output of `selectLineSegmentGroups`.
+		*  imageSize(cv::Size): size of the image.
+		*
+		* Ret:
+		*  index(int): index of the image.
+		*/
+		int addImage(const LineSegmentList &, cv::Size);
+
+		/**
+		* addImage
+		*
+		* Convenient function to run detection, filtering, grouping and
+		* selection of `image` on `rectifier` and add the result.
+		*/
+		int addImage(DistortionRectifier &, const cv::Mat &);
+
+		/**
+		* solve
+		*
+		* Function to estimate the joint parameters. Afterwards the
+		* worst image is dropped while its cost at the solution is
+		* more than 3 times the median one, re-solving from the current
+		* solution each time, until 3 images are left. Later calls
+		* start from the last solution, so images can be added and
+		* the estimate refined without starting over.
+		*
+		* Ret:
+		*  props(camera_props): camera properties of the lens.
+		*/
+		camera_props solve();
+
+		int getImageCount() const;
+		bool isImageActive(int) const;
+
+		/**
+		* getImageError
+		*
+		* Function to get the cost of an image at the last solution,
+		* or at the one it was dropped with.
+		*/
+		double getImageError(int) const;
+
+		/**
+		* getEvaluationCount
+		*
+		* Function to get the number of joint cost evaluations so far.
+		*/
+		long getEvaluationCount() const;
+
+	private:
+		distortion_model m_model;
+		int m_numParams;
+		cv::Size m_imageSize;
+		// scale of the optimized coefficients, k1 = x[0] / s^2 and k2 = x[1] / s^4
+		double m_scale;
+		std::vector<std::unique_ptr<CostEvaluator>> m_evaluators;
+		std::vector<int> m_groupCounts;
+		std::vector<bool> m_active;
+		std::vector<double> m_costs;
+		double m_solution[2];
+		long m_evaluations;
+
+		double mEvaluate(const double *);
+		void mMinimize();
+		camera_props mMakeCameraProps(double, double);
+	};
+
+} // namespace distrect
+
+#endif //JOINTCALIB_HPP
@@ -1,8 +1,18 @@
 #ifndef LIBDISTRECT_HPP
 #define LIBDISTRECT_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 #include <MatlabEngine.hpp>
 #include <MatlabDataArray.hpp>
@@ -19,6 +29,58 @@ namespace distrect
 	const int MIN_NUM_OF_SELECTED_LINE_GROUPS = 5;
 	const double UNDIST_FULL = 1.0;
 	const double UNDIST_VALID = 0.0;
+	const int QUALITY_SCORE_WIDTH = 320;
+	const int QUALITY_ORIENTATION_BINS = 18;
+	const double QUALITY_EDGE_MAG_THRES = 50.0;
+	// the weakest frames in images/ have gradient energy 15.0, orientation
+	// spread 0.84, 9 filtered chains and 1600 px of filtered lines. the
+	// limits keep all of them, and reject every darkened copy and about
+	// 93% of strongly blurred and of sky-only copies of those frames
+	const double QUALITY_MIN_GRADIENT_ENERGY = 8.0;
+	const double QUALITY_MIN_ORIENTATION_SPREAD = 0.7;
+	const double QUALITY_MIN_LINE_LENGTH = 40.0 * FILTER_LENGTH_THRES;
+	// filtered edge chains. fewer than the groups the selection keeps
+	// rarely group into enough of them
+	const int QUALITY_MIN_LINE_CHAINS = MIN_NUM_OF_SELECTED_LINE_GROUPS;
+	const int BUDGET_WINDOW_SIZE = 30;
+	const int BUDGET_FRAMES_PER_WINDOW = 3;
+	const int EXECUTOR_NUM_THREADS = 2;
+	const int ENGINE_POOL_MAX_ENGINES = 8;
+	const int ASYNC_POLL_INTERVAL_MS = 20;
+	const int NEWTON_ITERATIONS = 10;
+	const int INIT_GUESS_ITERATIONS = 5;
+	const double INIT_GUESS_TOLERANCE = 1e-6;
+	const int INIT_GUESS_HALVINGS = 4;
+	const int DIVISION_INVERSE_ITERATIONS = 4;
+	const int CONVERSION_SAMPLES = 100;
+	const int REMAP_BAND_ROWS = 32;
+	const int DRIFT_SAMPLE_INTERVAL = 30;
+	const int DRIFT_BASELINE_SAMPLES = 10;
+	const int DRIFT_TRIGGER_SAMPLES = 3;
+	const double DRIFT_SMOOTHING = 0.2;
+	const double DRIFT_RATIO_THRES = 2.0;
+	const double DRIFT_MIN_ERROR = 1.0;
+	const size_t MAP_CACHE_BUDGET = 256 * 1024 * 1024;
+	// 1 keeps exact maps. coarser grids are opt-in, a step of 16 is off by
+	// up to about 0.65 px on a 720x405 image (division model, alpha 1).
+	const int MAP_GRID_STEP = 1;
+	const int DETECTION_TILE_OVERLAP = 64;
+	const double SEAM_ANGLE_THRES = 2.0;
+	const double SEAM_DIST_THRES = 2.0;
+	const double SEAM_JOIN_DIST = 3.0;
+	const double SEGMENT_MATCH_TOL = 2.0;
+	const int CHANGE_BLOCK_SIZE = 32;
+	const double CHANGE_THRES = 6.0;
+	const double INCREMENTAL_MAX_CHANGE = 0.5;
+	// behind a moving object the incremental lines fall below 95% agreement
+	// with full detection after about 10 frames
+	const int INCREMENTAL_REFRESH_FRAMES = 10;
+	const double INCREMENTAL_MIN_AGREEMENT = 0.95;
+	const int JOINT_MAX_ITERATIONS = 400;
+	const double JOINT_TOLERANCE = 1e-6;
+	const double JOINT_SIMPLEX_STEP = 0.05;
+	const double JOINT_OUTLIER_RATIO = 3.0;
+	const int JOINT_MIN_IMAGES = 3;
 
 	class ILineSegment
 	{
@@ -27,6 +89,8 @@ namespace distrect
 		ILineSegment(const ILineSegment &);
 		virtual ~ILineSegment();
 
+		ILineSegment &operator=(const ILineSegment &);
+
 		double a, b, sx, sy, ex, ey;
 		int segmentNo;
 		bool invert;
@@ -50,13 +114,236 @@ namespace distrect
 		}
 	};
 
+	enum distortion_model
+	{
+		// OpenCV radial model, distorted = undistorted * (1 + k1 r^2 + k2 r^4)
+		DIST_MODEL_POLYNOMIAL = 0,
+		// division model, undistorted = distorted / (1 + k1 r^2 + k2 r^4)
+		DIST_MODEL_DIVISION = 1
+	};
+
 	typedef struct camera_props_t
 	{
 		cv::Mat intrinsic_matrix, distortion_params;
+		distortion_model model = DIST_MODEL_POLYNOMIAL;
 	} camera_props;
 
 	typedef std::vector<std::vector<ILineSegment>> LineSegmentList;
 
+	enum calibration_status
+	{
+		CALIB_COMPLETE = 0,
+		CALIB_DEADLINE = 1,
+		CALIB_CANCELLED = 2
+	};
+
+	// first gate of `scoreFrame`/`scoreLineSegments` a frame failed
+	enum frame_rejection
+	{
+		FRAME_ACCEPTED = 0,
+		FRAME_LOW_GRADIENT_ENERGY = 1,
+		FRAME_NARROW_ORIENTATIONS = 2,
+		// nothing detected, or nothing left after `filterLineSegments`
+		FRAME_NO_LINES = 3,
+		FRAME_FEW_LINE_CHAINS = 4,
+		FRAME_SHORT_LINES = 5
+	};
+
+	// pipeline stages as recorded by `PipelineRecorder`
+	enum pipeline_stage
+	{
+		STAGE_DETECT = 0,
+		STAGE_FILTER = 1,
+		STAGE_GROUP = 2,
+		STAGE_SELECT = 3,
+		STAGE_ESTIMATE = 4,
+		STAGE_COUNT = 5
+	};
+
+	typedef struct calibration_result_t
+	{
+		// final parameters, the best-so-far parameters of the selection
+		// or the fallback passed to `calibrateAsync`, depending on status.
+		camera_props props;
+		calibration_status status;
+	} calibration_result;
+
+	class CalibrationCancelled : public std::runtime_error
+	{
+	public:
+		CalibrationCancelled(calibration_status status)
+			: std::runtime_error(status == CALIB_DEADLINE ? "calibration deadline exceeded" : "calibration cancelled"),
+			  status(status)
+		{
+		}
+
+		calibration_status status;
+	};
+
+	class CancellationToken
+	{
+	public:
+		CancellationToken();
+		virtual ~CancellationToken();
+
+		/**
+		* cancel
+		*
+		* Function to request cancellation. Every copy of the token
+		* shares the same state.
+		*/
+		void cancel();
+		bool isCancelled() const;
+
+	private:
+		std::shared_ptr<std::atomic<bool>> m_cancelled;
+	};
+
+	class CalibrationExecutor
+	{
+	public:
+		CalibrationExecutor(int numThreads = EXECUTOR_NUM_THREADS);
+		virtual ~CalibrationExecutor();
+
+		/**
+		* instance
+		*
+		* Function to get the library-managed executor used by `calibrateAsync`.
+		*/
+		static CalibrationExecutor &instance();
+
+		/**
+		* post
+		*
+		* Function to queue a task. Tasks run in FIFO order on the worker threads.
+		*/
+		void post(std::function<void()>);
+
+	private:
+		std::vector<std::thread> m_workers;
+		std::deque<std::function<void()>> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_stopping;
+
+		void mWorkerLoop();
+	};
+
+	class MatlabEnginePool
+	{
+	public:
+		virtual ~MatlabEnginePool();
+
+		/**
+		* instance
+		*
+		* Function to get the process wide pool of extra MATLAB engines.
+		* An engine runs one call at a time, so tiles only run in
+		* parallel on engines of their own. The pool starts them once
+		* and lends them to every rectifier, instead of each rectifier
+		* starting and keeping a full engine per tile.
+		*/
+		static MatlabEnginePool &instance();
+
+		/**
+		* reserve
+		*
+		* Function to start engines until the pool holds `count`, at
+		* most 8. The missing ones are started together.
+		*
+		* Ret:
+		*  size(int): number of engines in the pool.
+		*/
+		int reserve(int);
+
+		/**
+		* acquire
+		*
+		* Function to borrow `count` engines, at most the pool size.
+		* Waits until all of them are free at once, so that no caller
+		* holds some engines while waiting for more.
+		*
+		* Args:
+		*  count(int): number of engines.
+		*  deadline(time_point): throws `CalibrationCancelled` when reached. default none.
+		*  token(CancellationToken): throws `CalibrationCancelled` when cancelled.
+		*/
+		std::vector<matlab::engine::MATLABEngine *> acquire(int, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+															CancellationToken token = CancellationToken());
+		void release(const std::vector<matlab::engine::MATLABEngine *> &);
+
+		/**
+		* attachClient
+		*
+		* Function to count a user of the MATLAB engine client, every
+		* `DistortionRectifier` is one. The last `detachClient` stops
+		* the pool's engines and then terminates the client, so that no
+		* engine outlives it while another rectifier still uses it.
+		*/
+		void attachClient();
+		void detachClient();
+
+	private:
+		MatlabEnginePool();
+
+		std::vector<std::unique_ptr<matlab::engine::MATLABEngine>> m_engines;
+		std::vector<matlab::engine::MATLABEngine *> m_free;
+		int m_clients;
+		std::mutex m_mutex, m_reserveMutex;
+		std::condition_variable m_released;
+	};
+
+	typedef struct frame_quality_t
+	{
+		// radius weighted mean gradient magnitude of the downscaled frame.
+		double gradientEnergy;
+		// normalized entropy of the edge orientation histogram, 0 to 1.
+		double orientationSpread;
+		// edge chains/lines left after `filterLineSegments`. -1 until scored.
+		int numLineChains, numLines;
+		double totalLineLength;
+		double score;
+		bool usable;
+		frame_rejection rejection;
+	} frame_quality;
+
+	class CalibrationFrameBudget
+	{
+	public:
+		CalibrationFrameBudget(int windowSize = BUDGET_WINDOW_SIZE, int framesPerWindow = BUDGET_FRAMES_PER_WINDOW);
+		virtual ~CalibrationFrameBudget();
+
+		/**
+		* push
+		*
+		* Function to offer a frame to the current window. Frames which
+		* are not usable are counted but never kept.
+		*
+		* Args:
+		*  frame(cv::Mat): candidate frame.
+		*  quality(frame_quality): quality reported for the frame.
+		*
+		* Ret:
+		*  complete(bool): true when the current window is complete.
+		*/
+		bool push(const cv::Mat &, const frame_quality &);
+
+		/**
+		* popSelected
+		*
+		* Function to retreive the best frames of the current window,
+		* best first, and start a new window.
+		*
+		* Ret:
+		*  frames(std::vector<cv::Mat>): at most `framesPerWindow` frames.
+		*/
+		std::vector<cv::Mat> popSelected();
+
+	private:
+		int m_windowSize, m_framesPerWindow, m_framesSeen;
+		std::vector<std::pair<double, cv::Mat>> m_best;
+	};
+
 	template <class _T>
 	_T scalar_mod(_T x, _T y)
 	{
@@ -92,9 +379,205 @@ namespace distrect
 		return rad * RAD_TO_DEG_MULT;
 	}
 
+	/**
+	* undistortPoint
+	*
+	* Function to map a distorted image point to its undistorted
+	* position, the same way `getDistParamError.m` does.
+	*
+	* Args:
+	*  point(cv::Point2d): distorted point in pixels.
+	*  props(camera_props): camera properties.
+	*
+	* Ret:
+	*  point(cv::Point2d): undistorted point in pixels.
+	*/
+	cv::Point2d undistortPoint(const cv::Point2d &, const camera_props &);
+
+	/**
+	* distortPoint
+	*
+	* Function to map an undistorted point to the distorted image.
+	* Direct for the polynomial model, closed form for the one
+	* parameter division model and a few Newton steps from that
+	* closed form for the two parameter one.
+	*
+	* Args:
+	*  point(cv::Point2d): undistorted point in pixels.
+	*  props(camera_props): camera properties.
+	*
+	* Ret:
+	*  point(cv::Point2d): distorted point in pixels, far outside the
+	*  image if no distorted point maps there.
+	*/
+	cv::Point2d distortPoint(const cv::Point2d &, const camera_props &);
+
+	/**
+	* getRectifyMapRows
+	*
+	* Function to compute the `cv::remap` maps of output rows
+	* [rowStart, rowEnd) only, so that no full size table is needed.
+	*
+	* Args:
+	*  props(camera_props): camera properties.
+	*  newCameraMatrix(cv::Mat): camera matrix of the output image.
+	*  rowStart(int), rowEnd(int): output rows to be mapped.
+	*  cols(int): output width.
+	*  mapX(cv::Mat), mapY(cv::Mat): CV_32F output maps.
+	*/
+	void getRectifyMapRows(const camera_props &, const cv::Mat &, int, int, int, cv::Mat &, cv::Mat &);
+
+	/**
+	* convertToOpenCVProps
+	*
+	* Function to convert division model properties to the OpenCV
+	* k1/k2 model by a least squares fit over the image radii.
+	* Polynomial properties are returned unchanged.
+	*
+	* Args:
+	*  props(camera_props): camera properties.
+	*  imageSize(cv::Size): size of the calibrated image.
+	*
+	* Ret:
+	*  props(camera_props): polynomial model properties.
+	*/
+	camera_props convertToOpenCVProps(const camera_props &, cv::Size);
+
+	/**
+	* makeCameraProps
+	*
+	* Function to build the camera properties every estimate uses:
+	* unit focal length, principal point at the image center and
+	* the given radial coefficients.
+	*
+	* Args:
+	*  imageSize(cv::Size): image size.
+	*  model(distortion_model): default DIST_MODEL_POLYNOMIAL.
+	*  k1(double), k2(double): default 0, i.e. no distortion.
+	*
+	* Ret:
+	*  props(camera_props)
+	*/
+	camera_props makeCameraProps(cv::Size, distortion_model model = DIST_MODEL_POLYNOMIAL, double k1 = 0.0, double k2 = 0.0);
+
+	/**
+	* getRectifyCameraMatrix
+	*
+	* Function to get the camera matrix of the rectified image, as
+	* `cv::getOptimalNewCameraMatrix` returns it for the OpenCV
+	* version of the properties.
+	*
+	* Args:
+	*  props(camera_props): camera properties.
+	*  imageSize(cv::Size): image size.
+	*  alpha(double): UNDIST_VALID to UNDIST_FULL.
+	*
+	* Ret:
+	*  newCameraMatrix(cv::Mat)
+	*/
+	cv::Mat getRectifyCameraMatrix(const camera_props &, cv::Size, double);
+
+	/**
+	* getNormalizationScale
+	*
+	* Function to get the half diagonal s of an image. The scaled
+	* coefficients k1 * s^2 and k2 * s^4 are of order one, which is
+	* where the initial guess, the seeded GetFMin search and the joint
+	* calibration work.
+	*
+	* Args:
+	*  imageSize(cv::Size): image size.
+	*
+	* Ret:
+	*  scale(double)
+	*/
+	double getNormalizationScale(cv::Size);
+
+	/**
+	* getLineGroupsError
+	*
+	* Native version of the `getDistParamError.m` cost: the mean over
+	* groups of the mean squared angle difference between the
+	* undistorted lines of each group.
+	*
+	* Args:
+	*  groups(LineSegmentList): selected line groups.
+	*  props(camera_props): camera properties to be graded.
+	*
+	* Ret:
+	*  error(double)
+	*/
+	double getLineGroupsError(const LineSegmentList &, const camera_props &);
+
+	typedef struct segment_agreement_t
+	{
+		// lines of the reference/other list with a match in the other one.
+		int matchedLines, referenceLines;
+		int otherMatchedLines, otherLines;
+		// reference chains whose lines all matched into a single chain.
+		int matchedChains, referenceChains;
+		// matched lines whose a/b line fits agree as well.
+		int matchedFits;
+		// matched lines pointing the same way.
+		int matchedDirections;
+	} segment_agreement;
+
+	/**
+	* compareLineSegments
+	*
+	* Function to compare two detections of the same image, e.g. tiled
+	* or incremental against whole-image detection. Lines match when
+	* both endpoints are within `tolerance` pixels, in either direction.
+	*
+	* Args:
+	*  reference(LineSegmentList): output of `getLineSegments`.
+	*  other(LineSegmentList): detection to be checked.
+	*  tolerance(double): default 2 pixels.
+	*
+	* Ret:
+	*  agreement(segment_agreement)
+	*/
+	segment_agreement compareLineSegments(const LineSegmentList &, const LineSegmentList &, double tolerance = SEGMENT_MATCH_TOL);
+
+	// what the last incremental `getLineSegments` did
+	enum incremental_update
+	{
+		// nothing changed, every chain was carried over
+		UPDATE_NONE = 0,
+		// only the changed region was detected again
+		UPDATE_REGION = 1,
+		// full detection on the first frame, a size change or too much change
+		UPDATE_FULL = 2,
+		// periodic full detection, compared with the incremental result
+		UPDATE_REFRESH = 3
+	};
+
+	typedef struct incremental_status_t
+	{
+		incremental_update update;
+		// region detected again, empty unless UPDATE_REGION.
+		cv::Rect region;
+		int framesSinceFull;
+		// incremental result against the full detection of the last
+		// refresh, all zero before the first one.
+		segment_agreement agreement;
+		// less than 95% of the lines of either result matched then.
+		bool diverged;
+	} incremental_status;
+
+	class RectifyMapCache;
+	class PipelineRecorder;
+
 	class DistortionRectifier
 	{
 	public:
+		/**
+		* DistortionRectifier
+		*
+		* The MATLAB engine is started on the first detection or
+		* parameter search, so the stages that don't need it can run
+		* on machines without MATLAB.
+		*/
 		DistortionRectifier();
 		virtual ~DistortionRectifier();
 
@@ -156,6 +639,34 @@ namespace distrect
 		*/
 		matlab::data::Array getMatlabImage(const cv::Mat &);
 
+		/**
+		* scoreFrame
+		*
+		* Function to cheaply predict whether the current image can
+		* constrain the distortion parameters. It works on a downscaled
+		* gray image only and doesn't run the line detection.
+		*
+		* Ret:
+		*  quality(frame_quality): gradient energy and orientation spread.
+		*/
+		frame_quality scoreFrame();
+
+		/**
+		* scoreLineSegments
+		*
+		* Function to complete a frame score with the filtered line
+		* segments. An empty list is rejected as FRAME_NO_LINES, so an
+		* empty detection can be scored without filtering it.
+		*
+		* Args:
+		*  segments(LineSegmentList): segments after `filterLineSegments`.
+		*  quality(frame_quality): score returned by `scoreFrame`.
+		*
+		* Ret:
+		*  quality(frame_quality)
+		*/
+		frame_quality scoreLineSegments(LineSegmentList, frame_quality);
+
 		/**
 		* getLineSegments
 		*
@@ -223,6 +734,152 @@ namespace distrect
 		*/
 		camera_props getCameraParams(LineSegmentList);
 
+		/**
+		* getInitialCameraParams
+		*
+		* Funtion to estimate k1/k2 without the optimizer. The
+		* straightness residual of every group is linearized in k and
+		* the small least squares system is solved, a few Gauss-Newton
+		* steps at most. A step is kept only if it lowers the
+		* `GetFMin` cost, so the guess never grades worse than [0;0].
+		* The result seeds `GetFMin` and follows the model set by
+		* `setDistortionModel`.
+		*
+		* Args:
+		*  segments(LineSegmentList): segments after filtering and grouping.
+		*
+		* Ret:
+		*  props(camera_props): camera properties structure.
+		*/
+		camera_props getInitialCameraParams(LineSegmentList);
+
+		/**
+		* setDistortionModel
+		*
+		* Function to select the model estimated by `getCameraParams`.
+		*
+		* Args:
+		*  model(distortion_model): default DIST_MODEL_POLYNOMIAL.
+		*  numParams(int): 1 to estimate k1 only, 2 for k1 and k2.
+		*/
+		void setDistortionModel(distortion_model, int numParams = 2);
+
+		/**
+		* setInitialGuess
+		*
+		* Function to enable/disable seeding the optimizer with
+		* `getInitialCameraParams` and warm starts. Enabled by default.
+		* Seeded searches run on the half-diagonal scaled coefficients,
+		* disabled ones are the original cold searches from [0;0].
+		*/
+		void setInitialGuess(bool);
+
+		/**
+		* getCostEvaluationCount
+		*
+		* Function to get the number of cost evaluations spent by the
+		* optimizer since the last reset.
+		*/
+		long getCostEvaluationCount();
+		void resetCostEvaluationCount();
+
+		/**
+		* setDetectionTiles
+		*
+		* Function to split `getLineSegments` into overlapping tiles
+		* detected in parallel on this rectifier's engine and engines
+		* borrowed from the `MatlabEnginePool`, queueing any tiles
+		* beyond those. Every line is kept by the tile owning its
+		* midpoint, then edge chains and collinear lines cut by a seam
+		* are joined again and renumbered. Missing pool engines are
+		* started here.
+		*
+		* Args:
+		*  tilesX(int), tilesY(int): tile grid, 1x1 (default) detects the whole image at once.
+		*  overlap(int): pixels each tile extends into its neighbours. default 64.
+		*/
+		void setDetectionTiles(int, int, int overlap = DETECTION_TILE_OVERLAP);
+
+		/**
+		* setIncrementalDetection
+		*
+		* Function to enable/disable temporal detection for video.
+		* `getLineSegments` then compares the image block by block with
+		* the frame its lines were detected on, re-detects only the
+		* changed region (plus the tile overlap as context) and carries
+		* the chains that don't touch the region over, joining them at
+		* the region border. A full detection runs on the first frame
+		* and when more than half of the image changed. Disabled by
+		* default.
+		*
+		* Every `refreshInterval`-th frame after a full detection is
+		* detected both ways. The full result is returned and becomes
+		* the new reference, and `getIncrementalStatus` reports how well
+		* the incremental one agreed with it.
+		*
+		* Args:
+		*  enabled(bool)
+		*  refreshInterval(int): default 10, 0 never refreshes.
+		*/
+		void setIncrementalDetection(bool, int refreshInterval = INCREMENTAL_REFRESH_FRAMES);
+
+		/**
+		* getIncrementalStatus
+		*
+		* Function to get what the last incremental detection did and
+		* the agreement measured at the last refresh.
+		*
+		* Ret:
+		*  status(incremental_status)
+		*/
+		incremental_status getIncrementalStatus();
+
+		/**
+		* setImageSize
+		*
+		* Function to run the stages after detection without an image,
+		* e.g. on segments from a `PipelineReplay`. Only the size is
+		* kept; detection and undistortion need `setImage`. Unlike
+		* `setImage`, no frame is started on the recorder.
+		*
+		* Args:
+		*  size(cv::Size): size of the recorded image.
+		*/
+		void setImageSize(cv::Size);
+
+		/**
+		* setRecorder
+		*
+		* Function to record the output and time of every stage to
+		* `recorder`, starting a new frame on every `setImage` and for
+		* an image that is already set. Pass nullptr to stop recording.
+		* A failing write stops the recording instead of the pipeline,
+		* see `getRecorderError`.
+		*/
+		void setRecorder(std::shared_ptr<PipelineRecorder>);
+
+		/**
+		* getRecorderError
+		*
+		* Function to get why the recorder was dropped.
+		*
+		* Ret:
+		*  error(std::string): empty while recording works.
+		*/
+		std::string getRecorderError();
+
+		/**
+		* setMapCache
+		*
+		* Function to rectify through cached maps instead of evaluating
+		* the model for every pixel. A cache may be shared by any
+		* number of rectifiers, pass nullptr to stop using it.
+		*
+		* Args:
+		*  cache(std::shared_ptr<RectifyMapCache>)
+		*/
+		void setMapCache(std::shared_ptr<RectifyMapCache>);
+
 		/**
 		* undistort
 		*
@@ -237,24 +894,130 @@ namespace distrect
 		*/
 		cv::Mat undistort(camera_props props, double alpha = UNDIST_VALID);
 
+		/**
+		* undistort
+		*
+		* Same as above, writing into `dst` instead of a new image. An
+		* empty `dst` is allocated, otherwise it must have the size and
+		* type of the current image and is written in place, e.g. a
+		* `FrameRingWriter` slot. Throws if it doesn't match.
+		*
+		* Args:
+		*  props(camera_props)
+		*  dst(cv::Mat): output image.
+		*/
+		void undistort(camera_props props, cv::Mat &dst, double alpha = UNDIST_VALID);
+
 		/**
 		* undistort
 		*
 		* Helper function to perform all operations sequentially
 		* and return undistorted image. This function doesn't return
-		* or save the camera parameters.
+		* or save the camera parameters. It throws before grouping and
+		* optimization when `scoreFrame`/`scoreLineSegments` report the
+		* image as unusable.
 		*
 		* Ret:
 		*  img(cv::Mat): undistorted image copy.
 		*/
 		cv::Mat undistort();
 
+		/**
+		* calibrateAsync
+		*
+		* Function to run the whole calibration of `image` on the
+		* library-managed executor. Cancellation and the deadline are
+		* checked between stages and between selection iterations;
+		* when either hits, the future is set with the best parameters
+		* found so far, or `fallback` if the selection hadn't produced
+		* any yet. Jobs run on a worker rectifier of their own with
+		* the model, initial guess and tile settings at the time of
+		* the call, so this rectifier's image is left alone and it can
+		* keep serving `setImage`/`undistort` meanwhile. The worker and
+		* its MATLAB engine are started by the first job. Calls on the
+		* same rectifier queue up on it and run one at a time; only the
+		* running one occupies an executor thread, so the other threads
+		* stay free for other rectifiers. The rectifier must outlive the
+		* returned future.
+		*
+		* Args:
+		*  image(cv::Mat): color image to be calibrated.
+		*  deadline(std::chrono::steady_clock::time_point): time budget.
+		*  fallback(camera_props): usually the previous calibration.
+		*  token(CancellationToken): optional token to cancel the job.
+		*
+		* Ret:
+		*  result(std::future<calibration_result>)
+		*/
+		std::future<calibration_result> calibrateAsync(const cv::Mat, std::chrono::steady_clock::time_point, camera_props, CancellationToken = CancellationToken());
+
 	private:
+		typedef struct calibration_control_t
+		{
+			std::chrono::steady_clock::time_point deadline;
+			CancellationToken token;
+			// settings of the rectifier when the job was posted
+			distortion_model model;
+			int numDistParams;
+			bool useInitialGuess;
+			int tilesX, tilesY, tileOverlap;
+		} calibration_control;
+
 		cv::Mat m_curImage, m_curGrayImage;
+		// all the stages after detection use, also set by `setImageSize`
+		cv::Size m_imageSize;
 		matlab::data::ArrayFactory m_arrayFactory;
 		std::unique_ptr<matlab::engine::MATLABEngine> m_matlabEngine;
 
+		std::mutex m_jobsMutex, m_engineMutex;
+		std::condition_variable m_jobsDone;
+		int m_pendingJobs;
+		// `calibrateAsync` jobs waiting for the running one to finish
+		std::deque<std::function<void()>> m_jobs;
+		bool m_jobRunning;
+		// runs the `calibrateAsync` jobs, only touched by them
+		std::unique_ptr<DistortionRectifier> m_worker;
+		const calibration_control *m_control;
+		camera_props m_bestProps;
+		double m_bestError;
+		distortion_model m_model;
+		int m_numDistParams;
+		bool m_useInitialGuess, m_hasWarmStart;
+		double m_warmStart[2];
+		long m_costEvaluations;
+		std::shared_ptr<RectifyMapCache> m_mapCache;
+		int m_tilesX, m_tilesY, m_tileOverlap;
+		bool m_incremental;
+		cv::Mat m_refGrayImage;
+		LineSegmentList m_prevSegments;
+		int m_framesSinceFull, m_refreshInterval;
+		incremental_status m_incrementalStatus;
+		std::shared_ptr<PipelineRecorder> m_recorder;
+		std::string m_recorderError;
+
 		void mSetImage(cv::Mat);
+		camera_props mRunPipeline();
+		static std::string mGetRejectionMessage(frame_rejection);
+		camera_props mMakeCameraProps(double, double);
+		calibration_result mCalibrate(cv::Mat, calibration_control, camera_props);
+		calibration_result mRunJob(cv::Mat, const calibration_control &, camera_props);
+		void mRunQueuedJobs();
+		void mCheckpoint();
+		matlab::engine::MATLABEngine &mGetEngine();
+		matlab::data::Array mFeval(const std::string &, const std::vector<matlab::data::Array> &);
+		std::vector<matlab::data::Array> mFevalTiles(const std::string &, const std::vector<std::vector<matlab::data::Array>> &);
+		std::vector<ILineSegment> mParseLineSegments(matlab::data::TypedArray<double> &);
+		LineSegmentList mChainLineSegments(const std::vector<ILineSegment> &);
+		LineSegmentList mDetectLineSegments();
+		void mRecord(pipeline_stage, const LineSegmentList &, int64_t);
+		void mRecord(const camera_props &, int64_t);
+		void mBeginRecordedFrame();
+		void mStopRecording(const std::exception &);
+		LineSegmentList mGetTiledLineSegments();
+		LineSegmentList mGetIncrementalLineSegments();
+		LineSegmentList mDetectChangedLineSegments();
+		matlab::data::TypedArray<double> mGetFMin(const matlab::data::Array &, LineSegmentList, const double *);
+		matlab::data::Array mGetMatlabImageSize();
 		matlab::data::CellArray mGetLineSegments(LineSegmentList);
 		inline double mGetLineError(ILineSegment, ILineSegment);
 		inline double mGetDifferenceOfAngles(double, double);
@@ -278,6 +1041,72 @@ namespace distrect
 		}
 	};
 
+	typedef struct drift_status_t
+	{
+		// number of frames measured so far
+		int samples;
+		// mean residual of the first `DRIFT_BASELINE_SAMPLES` measured frames
+		double baseline;
+		// exponential moving average of the residual
+		double current;
+		double lastError;
+		bool recalibrate;
+	} drift_status;
+
+	class CalibrationDriftMonitor
+	{
+	public:
+		/**
+		* CalibrationDriftMonitor
+		*
+		* Monitor of one camera's rectified output. Every sampled frame
+		* goes through detection, `filterLineSegments` and
+		* `groupLineSegments` on a rectifier of the monitor's own, so
+		* the image of the camera's rectifier is left alone. The
+		* residual is the `getLineGroupsError` angle error of the
+		* groups without any further distortion.
+		*
+		* Args:
+		*  sampleInterval(int): frames between two measured frames.
+		*  ratioThres(double): residual over baseline ratio raising the trigger.
+		*/
+		CalibrationDriftMonitor(int sampleInterval = DRIFT_SAMPLE_INTERVAL, double ratioThres = DRIFT_RATIO_THRES);
+		virtual ~CalibrationDriftMonitor();
+
+		/**
+		* addFrame
+		*
+		* Function to feed a rectified frame. Frames without enough long
+		* line groups are skipped.
+		*
+		* Args:
+		*  frame(cv::Mat): rectified color frame.
+		*
+		* Ret:
+		*  recalibrate(bool): true once the residual drift crossed the threshold
+		*  for `DRIFT_TRIGGER_SAMPLES` measured frames in a row.
+		*/
+		bool addFrame(const cv::Mat &);
+
+		drift_status getStatus();
+
+		/**
+		* reset
+		*
+		* Function to restart the baseline, e.g. after recalibration.
+		*/
+		void reset();
+
+	private:
+		// created with the first measured frame
+		std::unique_ptr<DistortionRectifier> m_rectifier;
+		int m_sampleInterval, m_frameCount, m_samplesAbove;
+		double m_ratioThres;
+		drift_status m_status;
+
+		bool mMeasure(const cv::Mat &, double &);
+	};
+
 } // namespace distrect
 
 #endif //LIBDISTRECT_HPP
\ No newline at end of file
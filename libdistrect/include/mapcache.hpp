@@ -0,0 +1,157 @@
+#ifndef MAPCACHE_HPP
+#define MAPCACHE_HPP
+
+#include <list>
+#include <unordered_map>
+#include <libdistrect.hpp>
+
+namespace distrect
+{
+
+	typedef struct rectify_map_t
+	{
+		// source coordinates of every `gridStep`-th output pixel. a step
+		// of 1 is a full size map, the last node of a grid may lie past
+		// the image border.
+		cv::Mat mapX, mapY;
+		cv::Size size;
+		int gridStep;
+		size_t bytes;
+		// one flag per row of grid cells. cells next to a node the model
+		// can't reach are not interpolated, their pixel rows are mapped
+		// exactly from `props` and `newCameraMatrix` instead.
+		std::vector<uchar> exactCellRows;
+		camera_props props;
+		cv::Mat newCameraMatrix;
+	} rectify_map;
+
+	typedef struct map_cache_stats_t
+	{
+		long hits = 0;
+		long misses = 0;
+		long evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	} map_cache_stats;
+
+	/**
+	* getRectifyMap
+	*
+	* Function to compute the map of `props`, full size or as a coarse
+	* grid expanded bilinearly by `remapImage`. A grid node is invalid
+	* when its source lies more than an image size outside the image,
+	* which is where the division model's unreachable radii end up.
+	*
+	* Args:
+	*  props(camera_props): camera properties.
+	*  imageSize(cv::Size): image size.
+	*  alpha(double): UNDIST_VALID to UNDIST_FULL.
+	*  gridStep(int): 1 for a full size map, n to keep every n-th pixel.
+	*
+	* Ret:
+	*  map(rectify_map)
+	*/
+	rectify_map getRectifyMap(const camera_props &, cv::Size, double, int gridStep = 1);
+
+	/**
+	* remapImage
+	*
+	* Function to rectify `src` into `dst` through `map`, band by band
+	* in parallel. Grids are expanded one band at a time, so no full
+	* size map is ever allocated.
+	*
+	* Args:
+	*  map(rectify_map)
+	*  src(cv::Mat): distorted image.
+	*  dst(cv::Mat): output image, same size and type as `src`.
+	*/
+	void remapImage(const rectify_map &, const cv::Mat &, cv::Mat &);
+
+	class RectifyMapCache
+	{
+	public:
+		/**
+		* RectifyMapCache
+		*
+		* Thread safe LRU cache of rectification maps keyed by camera
+		* properties, image size and alpha. Least recently used maps
+		* are dropped once the cache holds more than `byteBudget`;
+		* maps still held by a caller stay valid after eviction.
+		*
+		* Args:
+		*  byteBudget(size_t): default 256 MB.
+		*  gridStep(int): 1 for exact full size maps (default), n for
+		*   grids 1/n^2 the size. on 720x405 images the grid is off by
+		*   at most 0.05 px at n = 4, 0.18 px at 8 and 0.65 px at 16.
+		*/
+		RectifyMapCache(size_t byteBudget = MAP_CACHE_BUDGET, int gridStep = MAP_GRID_STEP);
+		virtual ~RectifyMapCache();
+
+		/**
+		* get
+		*
+		* Function to get the map of a camera, computing it on a miss.
+		* Maps larger than the whole budget are returned uncached.
+		*
+		* Args:
+		*  props(camera_props)
+		*  imageSize(cv::Size)
+		*  alpha(double)
+		*
+		* Ret:
+		*  map(std::shared_ptr<const rectify_map>)
+		*/
+		std::shared_ptr<const rectify_map> get(const camera_props &, cv::Size, double);
+
+		void setByteBudget(size_t);
+		map_cache_stats getStats();
+
+		/**
+		* clear
+		*
+		* Function to drop every cached map. Hit, miss and eviction
+		* counts are kept, `resetStats` zeroes them.
+		*/
+		void clear();
+		void resetStats();
+
+	private:
+		typedef struct map_key_t
+		{
+			uint64_t propsHash;
+			// intrinsics and distortion parameters the hash was taken over
+			std::vector<float> props;
+			int model;
+			int width, height;
+			double alpha;
+
+			// the hash only rejects early, colliding props must not share a map
+			bool operator==(const map_key_t &other) const
+			{
+				return propsHash == other.propsHash && width == other.width && height == other.height &&
+					   alpha == other.alpha && model == other.model && props == other.props;
+			}
+		} map_key;
+
+		struct map_key_hash
+		{
+			size_t operator()(const map_key &key) const;
+		};
+
+		typedef std::pair<map_key, std::shared_ptr<const rectify_map>> entry;
+
+		std::mutex m_mutex;
+		// most recently used first
+		std::list<entry> m_entries;
+		std::unordered_map<map_key, std::list<entry>::iterator, map_key_hash> m_index;
+		size_t m_byteBudget;
+		int m_gridStep;
+		map_cache_stats m_stats;
+
+		static map_key mMakeKey(const camera_props &, cv::Size, double);
+		void mEvict();
+	};
+
+} // namespace distrect
+
+#endif //MAPCACHE_HPP
@@ -0,0 +1,169 @@
+#ifndef PIPELINERECORD_HPP
+#define PIPELINERECORD_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <libdistrect.hpp>
+
+namespace distrect
+{
+
+	const uint32_t RECORD_MAGIC = 0x43525244; // "DRRC"
+	const uint32_t RECORD_VERSION = 1;
+	const int RECORD_MAX_DIST_PARAMS = 8;
+
+	// a record file is a record_file_header followed by chunks. every
+	// chunk is a record_chunk_header and `size` bytes of payload, padded
+	// with zeros to a multiple of 8 so that all payloads stay aligned
+	// when the file is mapped. values are in native byte order.
+	//
+	// payloads by tag:
+	//  RECORD_FRAME: int32 width, int32 height
+	//  RECORD_SEGMENTS: uint32 noChains, uint32 noLines, uint32 chain
+	//   lengths padded to 8 bytes, then noLines record_line
+	//  RECORD_PROPS: record_props
+	//  RECORD_TIMING: double seconds
+	enum record_tag
+	{
+		RECORD_FRAME = 1,
+		RECORD_SEGMENTS = 2,
+		RECORD_PROPS = 3,
+		RECORD_TIMING = 4
+	};
+
+	typedef struct record_file_header_t
+	{
+		uint32_t magic, version;
+		uint64_t reserved;
+	} record_file_header;
+
+	typedef struct record_chunk_header_t
+	{
+		uint16_t tag, stage;
+		uint32_t frame;
+		uint64_t size;
+	} record_chunk_header;
+
+	typedef struct record_line_t
+	{
+		double a, b, sx, sy, ex, ey;
+		int32_t segmentNo, invert;
+	} record_line;
+
+	typedef struct record_props_t
+	{
+		uint32_t model, noDistParams;
+		double intrinsic[9];
+		double distortion[RECORD_MAX_DIST_PARAMS];
+	} record_props;
+
+	class PipelineRecorder
+	{
+	public:
+		/**
+		* PipelineRecorder
+		*
+		* Writes stage outputs of any number of frames to a record
+		* file, see `DistortionRectifier::setRecorder`. Thread safe.
+		*
+		* Args:
+		*  path(std::string): file to be created, overwritten if it exists.
+		*/
+		PipelineRecorder(const std::string &);
+		virtual ~PipelineRecorder();
+
+		/**
+		* beginFrame
+		*
+		* Function to start the next frame, numbered from 0.
+		*/
+		void beginFrame(cv::Size);
+		void writeSegments(pipeline_stage, const LineSegmentList &);
+		void writeProps(const camera_props &);
+		void writeTiming(pipeline_stage, double);
+		int getFrameCount();
+
+	private:
+		std::mutex m_mutex;
+		std::ofstream m_file;
+		uint32_t m_frameCount;
+
+		void mWriteChunk(record_tag, pipeline_stage, const std::vector<const void *> &, const std::vector<size_t> &);
+	};
+
+	class PipelineReplay
+	{
+	public:
+		/**
+		* PipelineReplay
+		*
+		* Maps a record file read only and indexes its chunks. A
+		* truncated last chunk, e.g. of a crashed run, is ignored.
+		*
+		* Args:
+		*  path(std::string): record file.
+		*/
+		PipelineReplay(const std::string &);
+		virtual ~PipelineReplay();
+
+		int getFrameCount();
+		cv::Size getImageSize(int);
+		bool hasStage(int, pipeline_stage);
+
+		/**
+		* getLines
+		*
+		* Function to get the recorded lines of a stage without any
+		* copy. Valid as long as the replay.
+		*
+		* Args:
+		*  frame(int)
+		*  stage(pipeline_stage)
+		*  count(size_t): output number of lines.
+		*
+		* Ret:
+		*  lines(const record_line *): nullptr if the stage wasn't recorded.
+		*/
+		const record_line *getLines(int, pipeline_stage, size_t &);
+
+		/**
+		* getSegments
+		*
+		* Function to get the recorded output of a stage as it was
+		* passed to the next one.
+		*/
+		LineSegmentList getSegments(int, pipeline_stage);
+		camera_props getCameraProps(int);
+
+		/**
+		* getTiming
+		*
+		* Function to get the recorded time of a stage in seconds, -1 if none.
+		*/
+		double getTiming(int, pipeline_stage);
+
+	private:
+		typedef struct frame_index_t
+		{
+			cv::Size size;
+			// payload offsets, 0 if not recorded
+			uint64_t segments[STAGE_COUNT];
+			uint64_t props;
+			double timing[STAGE_COUNT];
+		} frame_index;
+
+		PipelineReplay(const PipelineReplay &);
+		PipelineReplay &operator=(const PipelineReplay &);
+
+		uint8_t *m_data;
+		size_t m_size;
+		void *m_handle;
+		std::vector<frame_index> m_frames;
+
+		const frame_index &mGetFrame(int);
+		void mUnmap();
+	};
+
+} // namespace distrect
+
+#endif //PIPELINERECORD_HPP
@@ -0,0 +1,99 @@
+#ifndef STREAMRECT_HPP
+#define STREAMRECT_HPP
+
+#include <libdistrect.hpp>
+
+namespace distrect
+{
+
+	// called with the first output row of the band and the band itself,
+	// the band is only valid during the call
+	typedef std::function<void(int, const cv::Mat &)> band_sink;
+
+	class StreamingRectifier
+	{
+	public:
+		/**
+		* StreamingRectifier
+		*
+		* Rectifies a frame fed in row order, e.g. from a line based
+		* sensor or decoder, without ever holding a full frame. For
+		* every output band the source rows the model samples are
+		* computed once here; input rows are kept in a ring buffer
+		* just large enough for the widest window and dropped as soon
+		* as no remaining band needs them.
+		*
+		* Args:
+		*  props(camera_props): camera properties.
+		*  imageSize(cv::Size): frame size.
+		*  type(int): frame type, e.g. CV_8UC3.
+		*  alpha(double): UNDIST_VALID (default) to UNDIST_FULL.
+		*  bandRows(int): output rows per band. default 32.
+		*/
+		StreamingRectifier(const camera_props &, cv::Size, int, double alpha = UNDIST_VALID, int bandRows = REMAP_BAND_ROWS);
+		virtual ~StreamingRectifier();
+
+		/**
+		* push
+		*
+		* Function to feed the next input rows. Every output band
+		* whose source rows are complete is rectified and passed to
+		* `sink`, in order.
+		*
+		* Args:
+		*  rows(cv::Mat): next rows of the frame, any number.
+		*  sink(band_sink): receives the finished output bands.
+		*/
+		void push(const cv::Mat &, const band_sink &);
+
+		/**
+		* reset
+		*
+		* Function to start a new frame. Rows of an unfinished frame are dropped.
+		*/
+		void reset();
+
+		/**
+		* getBufferRows
+		*
+		* Function to get the number of input rows the ring buffer holds.
+		*/
+		int getBufferRows() const;
+
+		/**
+		* getWorkingMemory
+		*
+		* Function to get the peak working memory in bytes: ring
+		* buffer, band maps, output band and the window table. All of
+		* it is allocated by the constructor.
+		*/
+		size_t getWorkingMemory() const;
+
+	private:
+		typedef struct band_window_t
+		{
+			// source rows [start, end) sampled by the band, empty if
+			// the band lies outside the source image
+			int start, end;
+			// input rows needed before the band can be emitted, and
+			// the first row any band from here on still needs
+			int ready, keepFrom;
+		} band_window;
+
+		cv::Size m_size;
+		int m_type, m_bandRows, m_capacity;
+		camera_props m_props;
+		cv::Mat m_newCameraMatrix;
+		std::vector<band_window> m_windows;
+		// every row is stored twice, so that any window of up to
+		// `m_capacity` rows is contiguous
+		cv::Mat m_buffer;
+		cv::Mat m_mapX, m_mapY, m_band;
+		int m_received, m_nextBand;
+
+		void mEmitBand(int, const band_sink &);
+	};
+
+} // namespace distrect
+
+#endif //STREAMRECT_HPP
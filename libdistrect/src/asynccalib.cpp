@@ -0,0 +1,482 @@
+#include <libdistrect.hpp>
+#include <limits>
+
+using namespace std;
+
+namespace distrect
+{
+CancellationToken::CancellationToken()
+    : m_cancelled(make_shared<atomic<bool>>(false))
+{
+}
+
+CancellationToken::~CancellationToken() {}
+
+void CancellationToken::cancel()
+{
+    m_cancelled->store(true);
+}
+
+bool CancellationToken::isCancelled() const
+{
+    return m_cancelled->load();
+}
+
+CalibrationExecutor::CalibrationExecutor(int numThreads)
+    : m_stopping(false)
+{
+    if (numThreads < 1)
+    {
+        throw runtime_error("executor needs at least one thread");
+    }
+
+    for (int i = 0; i < numThreads; i++)
+    {
+        m_workers.push_back(thread(&CalibrationExecutor::mWorkerLoop, this));
+    }
+}
+
+CalibrationExecutor::~CalibrationExecutor()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto &worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+CalibrationExecutor &CalibrationExecutor::instance()
+{
+    static CalibrationExecutor executor;
+    return executor;
+}
+
+void CalibrationExecutor::post(function<void()> task)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_stopping)
+        {
+            throw runtime_error("executor is shutting down");
+        }
+        m_tasks.push_back(task);
+    }
+    m_condition.notify_one();
+}
+
+void CalibrationExecutor::mWorkerLoop()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+            // drain the queue before stopping, callers wait on the futures
+            if (m_tasks.empty())
+            {
+                return;
+            }
+
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+MatlabEnginePool::MatlabEnginePool()
+    : m_clients(0)
+{
+}
+
+MatlabEnginePool::~MatlabEnginePool() {}
+
+MatlabEnginePool &MatlabEnginePool::instance()
+{
+    static MatlabEnginePool pool;
+    return pool;
+}
+
+int MatlabEnginePool::reserve(int count)
+{
+    lock_guard<mutex> reserveLock(m_reserveMutex);
+    size_t target = (size_t)min(max(count, 0), ENGINE_POOL_MAX_ENGINES);
+    size_t current;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        current = m_engines.size();
+    }
+
+    // engines take seconds to start, so start the missing ones together
+    // without blocking the engines already lent out
+    vector<matlab::engine::FutureResult<unique_ptr<matlab::engine::MATLABEngine>>> starting;
+    for (size_t i = current; i < target; i++)
+    {
+        starting.push_back(matlab::engine::startMATLABAsync());
+    }
+    vector<unique_ptr<matlab::engine::MATLABEngine>> started;
+    for (auto &engine : starting)
+    {
+        started.push_back(engine.get());
+    }
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        for (auto &engine : started)
+        {
+            m_free.push_back(engine.get());
+            m_engines.push_back(move(engine));
+        }
+        current = m_engines.size();
+    }
+    m_released.notify_all();
+
+    return (int)current;
+}
+
+vector<matlab::engine::MATLABEngine *> MatlabEnginePool::acquire(int count, chrono::steady_clock::time_point deadline, CancellationToken token)
+{
+    unique_lock<mutex> lock(m_mutex);
+    size_t wanted = (size_t)min(max(count, 0), (int)m_engines.size());
+
+    // the token can't wake us up, so check it every poll interval
+    while (m_free.size() < wanted)
+    {
+        if (token.isCancelled())
+        {
+            throw CalibrationCancelled(CALIB_CANCELLED);
+        }
+        if (chrono::steady_clock::now() >= deadline)
+        {
+            throw CalibrationCancelled(CALIB_DEADLINE);
+        }
+        m_released.wait_for(lock, chrono::milliseconds(ASYNC_POLL_INTERVAL_MS));
+    }
+
+    vector<matlab::engine::MATLABEngine *> engines(m_free.end() - wanted, m_free.end());
+    m_free.resize(m_free.size() - wanted);
+    return engines;
+}
+
+void MatlabEnginePool::release(const vector<matlab::engine::MATLABEngine *> &engines)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_free.insert(m_free.end(), engines.begin(), engines.end());
+    }
+    m_released.notify_all();
+}
+
+void MatlabEnginePool::attachClient()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_clients++;
+}
+
+void MatlabEnginePool::detachClient()
+{
+    // serialized with reserve, which may still be starting engines
+    lock_guard<mutex> reserveLock(m_reserveMutex);
+    lock_guard<mutex> lock(m_mutex);
+    if (--m_clients > 0)
+    {
+        return;
+    }
+
+    // no rectifier is left to borrow them, the engines have to go
+    // while the client is still up
+    m_free.clear();
+    m_engines.clear();
+    matlab::engine::terminateEngineClient();
+}
+
+future<calibration_result> DistortionRectifier::calibrateAsync(const cv::Mat image, chrono::steady_clock::time_point deadline, camera_props fallback, CancellationToken token)
+{
+    if (image.empty())
+    {
+        throw runtime_error("empty image found. nothing to calibrate.");
+    }
+
+    calibration_control control;
+    control.deadline = deadline;
+    control.token = token;
+    control.model = m_model;
+    control.numDistParams = m_numDistParams;
+    control.useInitialGuess = m_useInitialGuess;
+    control.tilesX = m_tilesX;
+    control.tilesY = m_tilesY;
+    control.tileOverlap = m_tileOverlap;
+
+    auto promise = make_shared<std::promise<calibration_result>>();
+    future<calibration_result> result = promise->get_future();
+
+    cv::Mat imageCopy = image.clone();
+    function<void()> job = [this, promise, imageCopy, control, fallback]() {
+        try
+        {
+            promise->set_value(mCalibrate(imageCopy, control, fallback));
+        }
+        catch (...)
+        {
+            promise->set_exception(current_exception());
+        }
+    };
+
+    bool idle;
+    {
+        lock_guard<mutex> lock(m_jobsMutex);
+        m_pendingJobs++;
+        m_jobs.push_back(job);
+        idle = !m_jobRunning;
+        m_jobRunning = true;
+    }
+
+    // a job already running on this rectifier picks the new one up when
+    // it's done, so no executor thread sits waiting for it
+    if (idle)
+    {
+        try
+        {
+            CalibrationExecutor::instance().post([this]() { mRunQueuedJobs(); });
+        }
+        catch (...)
+        {
+            lock_guard<mutex> lock(m_jobsMutex);
+            m_jobs.pop_back();
+            m_pendingJobs--;
+            m_jobRunning = false;
+            m_jobsDone.notify_all();
+            throw;
+        }
+    }
+
+    return result;
+}
+
+void DistortionRectifier::mRunQueuedJobs()
+{
+    while (true)
+    {
+        function<void()> job;
+        {
+            lock_guard<mutex> lock(m_jobsMutex);
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        job();
+
+        {
+            lock_guard<mutex> lock(m_jobsMutex);
+            m_pendingJobs--;
+            if (m_jobs.empty())
+            {
+                m_jobRunning = false;
+                // notify under the lock, the destructor may run right after it
+                m_jobsDone.notify_all();
+                return;
+            }
+        }
+
+        // queue the next job behind the other rectifiers' jobs rather than
+        // keeping this thread, the pending count keeps this instance alive
+        try
+        {
+            CalibrationExecutor::instance().post([this]() { mRunQueuedJobs(); });
+            return;
+        }
+        catch (const runtime_error &)
+        {
+            // the executor is shutting down, finish the queue here
+        }
+    }
+}
+
+calibration_result DistortionRectifier::mCalibrate(cv::Mat image, calibration_control control, camera_props fallback)
+{
+    // the caller keeps using this rectifier for its own frames, so the
+    // job must neither replace its image nor leave m_control set on it.
+    // jobs of one rectifier run one at a time (see `mRunQueuedJobs`), so
+    // the worker needs no lock.
+    if (!m_worker)
+    {
+        m_worker.reset(new DistortionRectifier());
+    }
+
+    // only apply changes, both setters drop the worker's warm start
+    if (m_worker->m_model != control.model || m_worker->m_numDistParams != control.numDistParams)
+    {
+        m_worker->setDistortionModel(control.model, control.numDistParams);
+    }
+    if (m_worker->m_useInitialGuess != control.useInitialGuess)
+    {
+        m_worker->setInitialGuess(control.useInitialGuess);
+    }
+    if (m_worker->m_tilesX != control.tilesX || m_worker->m_tilesY != control.tilesY || m_worker->m_tileOverlap != control.tileOverlap)
+    {
+        m_worker->setDetectionTiles(control.tilesX, control.tilesY, control.tileOverlap);
+    }
+
+    return m_worker->mRunJob(image, control, fallback);
+}
+
+calibration_result DistortionRectifier::mRunJob(cv::Mat image, const calibration_control &control, camera_props fallback)
+{
+    calibration_result result;
+    result.props = fallback;
+    result.status = CALIB_COMPLETE;
+
+    m_control = &control;
+    m_bestError = numeric_limits<double>::max();
+    try
+    {
+        mSetImage(image);
+        mCheckpoint();
+        result.props = mRunPipeline();
+    }
+    catch (const CalibrationCancelled &e)
+    {
+        result.status = e.status;
+        if (m_bestError < numeric_limits<double>::max())
+        {
+            result.props = m_bestProps;
+        }
+    }
+    catch (...)
+    {
+        m_control = nullptr;
+        throw;
+    }
+    m_control = nullptr;
+
+    return result;
+}
+
+void DistortionRectifier::mCheckpoint()
+{
+    if (m_control == nullptr)
+    {
+        return;
+    }
+
+    if (m_control->token.isCancelled())
+    {
+        throw CalibrationCancelled(CALIB_CANCELLED);
+    }
+
+    if (chrono::steady_clock::now() >= m_control->deadline)
+    {
+        throw CalibrationCancelled(CALIB_DEADLINE);
+    }
+}
+
+matlab::engine::MATLABEngine &DistortionRectifier::mGetEngine()
+{
+    // started on first use, grouping and selection don't need it
+    lock_guard<mutex> lock(m_engineMutex);
+    if (!m_matlabEngine)
+    {
+        m_matlabEngine = matlab::engine::startMATLAB();
+    }
+    return *m_matlabEngine;
+}
+
+matlab::data::Array DistortionRectifier::mFeval(const string &function, const vector<matlab::data::Array> &args)
+{
+    matlab::engine::String name = matlab::engine::convertUTF8StringToUTF16String(function);
+    if (m_control == nullptr)
+    {
+        return mGetEngine().feval(name, args);
+    }
+
+    // a single GetFMin call can take seconds, so poll it instead of blocking
+    matlab::engine::FutureResult<matlab::data::Array> pending = mGetEngine().fevalAsync(name, args);
+    while (pending.wait_for(chrono::milliseconds(ASYNC_POLL_INTERVAL_MS)) != future_status::ready)
+    {
+        try
+        {
+            mCheckpoint();
+        }
+        catch (const CalibrationCancelled &)
+        {
+            pending.cancel();
+            throw;
+        }
+    }
+
+    return pending.get();
+}
+
+vector<matlab::data::Array> DistortionRectifier::mFevalTiles(const string &function, const vector<vector<matlab::data::Array>> &args)
+{
+    // this rectifier's engine plus engines borrowed for this call only
+    vector<matlab::engine::MATLABEngine *> engines(1, &mGetEngine());
+    MatlabEnginePool &pool = MatlabEnginePool::instance();
+    vector<matlab::engine::MATLABEngine *> borrowed = (m_control == nullptr)
+                                                          ? pool.acquire((int)args.size() - 1)
+                                                          : pool.acquire((int)args.size() - 1, m_control->deadline, m_control->token);
+    engines.insert(engines.end(), borrowed.begin(), borrowed.end());
+
+    matlab::engine::String name = matlab::engine::convertUTF8StringToUTF16String(function);
+    vector<matlab::data::Array> rv(args.size());
+    vector<matlab::engine::FutureResult<matlab::data::Array>> pending(engines.size());
+    vector<int> running(engines.size(), -1);
+    size_t next = 0, done = 0;
+    try
+    {
+        while (done < args.size())
+        {
+            // tiles beyond the engines wait for the first one to be free
+            for (size_t e = 0; e < engines.size(); e++)
+            {
+                if (running[e] < 0 && next < args.size())
+                {
+                    pending[e] = engines[e]->fevalAsync(name, args[next]);
+                    running[e] = (int)next++;
+                }
+            }
+
+            bool finished = false;
+            for (size_t e = 0; e < engines.size(); e++)
+            {
+                if (running[e] >= 0 && pending[e].wait_for(chrono::milliseconds(0)) == future_status::ready)
+                {
+                    rv[running[e]] = pending[e].get();
+                    running[e] = -1;
+                    done++;
+                    finished = true;
+                }
+            }
+            if (!finished)
+            {
+                mCheckpoint();
+                this_thread::sleep_for(chrono::milliseconds(ASYNC_POLL_INTERVAL_MS));
+            }
+        }
+    }
+    catch (...)
+    {
+        for (size_t e = 0; e < engines.size(); e++)
+        {
+            if (running[e] >= 0)
+            {
+                pending[e].cancel();
+            }
+        }
+        pool.release(borrowed);
+        throw;
+    }
+    pool.release(borrowed);
+
+    return rv;
+}
+
+} // namespace distrect
@@ -0,0 +1,141 @@
+#include <distkernels.hpp>
+
+using namespace std;
+
+namespace distrect
+{
+template <class _T>
+static double (*selectCostKernel(distortion_model model, int numParams))(const _T *, const int *, int, const kernels::lens_t<_T> &, _T *)
+{
+    if (model == DIST_MODEL_DIVISION)
+    {
+        return (numParams == 1) ? &kernels::lineGroupsErrorKernel<_T, DIST_MODEL_DIVISION, 1>
+                                : &kernels::lineGroupsErrorKernel<_T, DIST_MODEL_DIVISION, 2>;
+    }
+    return (numParams == 1) ? &kernels::lineGroupsErrorKernel<_T, DIST_MODEL_POLYNOMIAL, 1>
+                            : &kernels::lineGroupsErrorKernel<_T, DIST_MODEL_POLYNOMIAL, 2>;
+}
+
+cost_kernel_f selectCostKernelF(distortion_model model, int numParams)
+{
+    return selectCostKernel<float>(model, numParams);
+}
+
+cost_kernel_d selectCostKernelD(distortion_model model, int numParams)
+{
+    return selectCostKernel<double>(model, numParams);
+}
+
+map_kernel selectMapKernel(distortion_model model, int numParams)
+{
+    if (model == DIST_MODEL_DIVISION)
+    {
+        return (numParams == 1) ? &kernels::mapRowsKernel<float, DIST_MODEL_DIVISION, 1>
+                                : &kernels::mapRowsKernel<float, DIST_MODEL_DIVISION, 2>;
+    }
+    return (numParams == 1) ? &kernels::mapRowsKernel<float, DIST_MODEL_POLYNOMIAL, 1>
+                            : &kernels::mapRowsKernel<float, DIST_MODEL_POLYNOMIAL, 2>;
+}
+
+template <class _Pixel, int _Cn>
+static remap_kernel selectRemapKernelForPixel(distortion_model model, int numParams)
+{
+    if (model == DIST_MODEL_DIVISION)
+    {
+        return (numParams == 1) ? &kernels::remapRowsKernel<_Pixel, _Cn, float, DIST_MODEL_DIVISION, 1>
+                                : &kernels::remapRowsKernel<_Pixel, _Cn, float, DIST_MODEL_DIVISION, 2>;
+    }
+    return (numParams == 1) ? &kernels::remapRowsKernel<_Pixel, _Cn, float, DIST_MODEL_POLYNOMIAL, 1>
+                            : &kernels::remapRowsKernel<_Pixel, _Cn, float, DIST_MODEL_POLYNOMIAL, 2>;
+}
+
+remap_kernel selectRemapKernel(int type, distortion_model model, int numParams)
+{
+    switch (type)
+    {
+    case CV_MAKETYPE(CV_8U, 1):
+        return selectRemapKernelForPixel<uint8_t, 1>(model, numParams);
+    case CV_MAKETYPE(CV_8U, 3):
+        return selectRemapKernelForPixel<uint8_t, 3>(model, numParams);
+    case CV_MAKETYPE(CV_16U, 1):
+        return selectRemapKernelForPixel<uint16_t, 1>(model, numParams);
+    case CV_MAKETYPE(CV_16U, 3):
+        return selectRemapKernelForPixel<uint16_t, 3>(model, numParams);
+    case CV_MAKETYPE(CV_32F, 1):
+        return selectRemapKernelForPixel<float, 1>(model, numParams);
+    case CV_MAKETYPE(CV_32F, 3):
+        return selectRemapKernelForPixel<float, 3>(model, numParams);
+    default:
+        return nullptr;
+    }
+}
+
+CostEvaluator::CostEvaluator(const LineSegmentList &groups, const camera_props &props, int numParams, bool useFloat)
+    : m_numParams(numParams), m_useFloat(useFloat)
+{
+    if (numParams < 1 || numParams > 2)
+    {
+        throw runtime_error("number of distortion parameters must be 1 or 2");
+    }
+
+    size_t maxLines = 0;
+    for (auto &group : groups)
+    {
+        if (group.size() < 2)
+        {
+            continue;
+        }
+
+        for (auto &line : group)
+        {
+            double packed[4] = {line.sx, line.sy, line.ex, line.ey};
+            for (auto value : packed)
+            {
+                m_linesF.push_back(float(value));
+                m_linesD.push_back(value);
+            }
+        }
+        m_groupEnds.push_back(int(m_linesD.size() / 4));
+        maxLines = max(maxLines, group.size());
+    }
+
+    if (m_groupEnds.empty())
+    {
+        throw runtime_error("no line group with at least two lines found");
+    }
+
+    m_anglesF.resize(maxLines);
+    m_anglesD.resize(maxLines);
+    m_lensF = kernels::getLens<float>(props);
+    m_lensD = kernels::getLens<double>(props);
+    m_kernelF = selectCostKernelF(props.model, numParams);
+    m_kernelD = selectCostKernelD(props.model, numParams);
+}
+
+CostEvaluator::~CostEvaluator() {}
+
+double CostEvaluator::evaluate(double k1, double k2) const
+{
+    if (m_numParams < 2)
+    {
+        k2 = 0.0;
+    }
+
+    if (m_useFloat)
+    {
+        m_lensF.k[0] = float(k1);
+        m_lensF.k[1] = float(k2);
+        return m_kernelF(m_linesF.data(), m_groupEnds.data(), (int)m_groupEnds.size(), m_lensF, m_anglesF.data());
+    }
+
+    m_lensD.k[0] = k1;
+    m_lensD.k[1] = k2;
+    return m_kernelD(m_linesD.data(), m_groupEnds.data(), (int)m_groupEnds.size(), m_lensD, m_anglesD.data());
+}
+
+int CostEvaluator::getGroupCount() const
+{
+    return (int)m_groupEnds.size();
+}
+
+} // namespace distrect
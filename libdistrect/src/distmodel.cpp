@@ -0,0 +1,345 @@
+#include <distkernels.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace distrect
+{
+// scale taking a normalized distorted point at radius rd to its undistorted
+// position, with optional derivatives of that scale w.r.t. k1 and k2.
+static double getUndistortScale(double rd, double k1, double k2, distortion_model model, double *dk1 = nullptr, double *dk2 = nullptr)
+{
+    double rd2 = rd * rd;
+    if (model == DIST_MODEL_DIVISION)
+    {
+        // closed form, no inversion needed
+        double denom = 1.0 + k1 * rd2 + k2 * rd2 * rd2;
+        if (dk1 != nullptr)
+        {
+            *dk1 = -rd2 / (denom * denom);
+            *dk2 = -rd2 * rd2 / (denom * denom);
+        }
+        return 1.0 / denom;
+    }
+
+    // same Newton-Raphson inversion as `undistortLineGroup` in getDistParamError.m
+    double r = rd;
+    for (int i = 0; i < NEWTON_ITERATIONS; i++)
+    {
+        double r2 = r * r;
+        r = r - (r + k1 * r2 * r + k2 * r2 * r2 * r - rd) / (1.0 + 3.0 * k1 * r2 + 5.0 * k2 * r2 * r2);
+    }
+
+    double r2 = r * r;
+    if (dk1 != nullptr)
+    {
+        // the undistorted point is (x, y) * r / rd, with r implicit in k
+        double slope = 1.0 + 3.0 * k1 * r2 + 5.0 * k2 * r2 * r2;
+        *dk1 = (rd > 0.0) ? -(r2 * r) / slope / rd : 0.0;
+        *dk2 = (rd > 0.0) ? -(r2 * r2 * r) / slope / rd : 0.0;
+    }
+    return 1.0 / (1.0 + k1 * r2 + k2 * r2 * r2);
+}
+
+// scale taking a normalized undistorted point at radius ru to its distorted
+// position.
+static double getDistortScale(double ru, double k1, double k2, distortion_model model)
+{
+    double k[2] = {k1, k2};
+    if (model == DIST_MODEL_DIVISION)
+    {
+        return (k2 == 0.0) ? kernels::RadialModel<double, DIST_MODEL_DIVISION, 1>::distortScale(ru * ru, k)
+                           : kernels::RadialModel<double, DIST_MODEL_DIVISION, 2>::distortScale(ru * ru, k);
+    }
+    return kernels::RadialModel<double, DIST_MODEL_POLYNOMIAL, 2>::distortScale(ru * ru, k);
+}
+
+cv::Point2d undistortPoint(const cv::Point2d &point, const camera_props &props)
+{
+    double fx = props.intrinsic_matrix.at<float>(0, 0);
+    double fy = props.intrinsic_matrix.at<float>(1, 1);
+    double cx = props.intrinsic_matrix.at<float>(0, 2);
+    double cy = props.intrinsic_matrix.at<float>(1, 2);
+    double k1 = props.distortion_params.at<float>(0, 0);
+    double k2 = props.distortion_params.at<float>(0, 1);
+
+    double x = (point.x - cx) / fx;
+    double y = (point.y - cy) / fy;
+    double scale = getUndistortScale(sqrt(x * x + y * y), k1, k2, props.model);
+
+    return cv::Point2d(x * scale * fx + cx, y * scale * fy + cy);
+}
+
+cv::Point2d distortPoint(const cv::Point2d &point, const camera_props &props)
+{
+    double fx = props.intrinsic_matrix.at<float>(0, 0);
+    double fy = props.intrinsic_matrix.at<float>(1, 1);
+    double cx = props.intrinsic_matrix.at<float>(0, 2);
+    double cy = props.intrinsic_matrix.at<float>(1, 2);
+    double k1 = props.distortion_params.at<float>(0, 0);
+    double k2 = props.distortion_params.at<float>(0, 1);
+
+    double x = (point.x - cx) / fx;
+    double y = (point.y - cy) / fy;
+    double scale = getDistortScale(sqrt(x * x + y * y), k1, k2, props.model);
+
+    return cv::Point2d(x * scale * fx + cx, y * scale * fy + cy);
+}
+
+void getRectifyMapRows(const camera_props &props, const cv::Mat &newCameraMatrix, int rowStart, int rowEnd, int cols, cv::Mat &mapX, cv::Mat &mapY)
+{
+    kernels::lens_t<float> lens = kernels::getLens<float>(props);
+    kernels::lens_t<float> newLens = kernels::getNewLens<float>(newCameraMatrix);
+
+    mapX.create(rowEnd - rowStart, cols, CV_32F);
+    mapY.create(rowEnd - rowStart, cols, CV_32F);
+    selectMapKernel(props.model, getActiveParamCount(props))(lens, newLens, rowStart, rowEnd, mapX, mapY);
+}
+
+camera_props convertToOpenCVProps(const camera_props &props, cv::Size imageSize)
+{
+    if (props.model != DIST_MODEL_DIVISION)
+    {
+        return props;
+    }
+
+    double fx = props.intrinsic_matrix.at<float>(0, 0);
+    double fy = props.intrinsic_matrix.at<float>(1, 1);
+    double k1 = props.distortion_params.at<float>(0, 0);
+    double k2 = props.distortion_params.at<float>(0, 1);
+
+    // least squares fit of rd / ru - 1 = k1 * ru^2 + k2 * ru^4 over the
+    // distorted radii covered by the image
+    double maxRadius = sqrt(pow(imageSize.width / (2.0 * fx), 2.0) + pow(imageSize.height / (2.0 * fy), 2.0));
+    double n11 = 0.0, n12 = 0.0, n22 = 0.0, g1 = 0.0, g2 = 0.0;
+    for (int i = 1; i <= CONVERSION_SAMPLES; i++)
+    {
+        double rd = maxRadius * i / CONVERSION_SAMPLES;
+        double ru = rd * getUndistortScale(rd, k1, k2, DIST_MODEL_DIVISION);
+        if (ru <= 0.0)
+        {
+            continue;
+        }
+        double ru2 = ru * ru;
+        double target = rd / ru - 1.0;
+        n11 += ru2 * ru2;
+        n12 += ru2 * ru2 * ru2;
+        n22 += ru2 * ru2 * ru2 * ru2;
+        g1 += ru2 * target;
+        g2 += ru2 * ru2 * target;
+    }
+
+    double det = n11 * n22 - n12 * n12;
+    if (det == 0.0)
+    {
+        throw runtime_error("can't convert the division model parameters");
+    }
+
+    camera_props rv;
+    rv.intrinsic_matrix = props.intrinsic_matrix.clone();
+    rv.distortion_params = cv::Mat(1, 4, CV_32F, cv::Scalar(0.0));
+    rv.distortion_params.at<float>(0, 0) = float((n22 * g1 - n12 * g2) / det);
+    rv.distortion_params.at<float>(0, 1) = float((n11 * g2 - n12 * g1) / det);
+    rv.model = DIST_MODEL_POLYNOMIAL;
+
+    return rv;
+}
+
+camera_props makeCameraProps(cv::Size imageSize, distortion_model model, double k1, double k2)
+{
+    camera_props props;
+    props.intrinsic_matrix = cv::Mat(3, 3, CV_32F, cv::Scalar(0.0));
+    props.intrinsic_matrix.at<float>(0, 0) = 1.0f;
+    props.intrinsic_matrix.at<float>(0, 2) = float(imageSize.width) / 2.0f;
+    props.intrinsic_matrix.at<float>(1, 1) = 1.0f;
+    props.intrinsic_matrix.at<float>(1, 2) = float(imageSize.height) / 2.0f;
+    props.intrinsic_matrix.at<float>(2, 2) = 1.0f;
+
+    props.distortion_params = cv::Mat(1, 4, CV_32F, cv::Scalar(0.0));
+    props.distortion_params.at<float>(0, 0) = (float)k1;
+    props.distortion_params.at<float>(0, 1) = (float)k2;
+    props.model = model;
+
+    return props;
+}
+
+cv::Mat getRectifyCameraMatrix(const camera_props &props, cv::Size imageSize, double alpha)
+{
+    camera_props cvProps = convertToOpenCVProps(props, imageSize);
+
+    return cv::getOptimalNewCameraMatrix(cvProps.intrinsic_matrix, cvProps.distortion_params, imageSize, alpha);
+}
+
+double getNormalizationScale(cv::Size imageSize)
+{
+    return sqrt(pow(imageSize.width / 2.0, 2) + pow(imageSize.height / 2.0, 2));
+}
+
+double getLineGroupsError(const LineSegmentList &groups, const camera_props &props)
+{
+    CostEvaluator evaluator(groups, props, getActiveParamCount(props));
+
+    return evaluator.evaluate(props.distortion_params.at<float>(0, 0), props.distortion_params.at<float>(0, 1));
+}
+
+camera_props DistortionRectifier::getInitialCameraParams(LineSegmentList segments)
+{
+    if (m_imageSize.area() == 0)
+    {
+        throw runtime_error("image is not set. please set the image first.");
+    }
+    if (segments.empty())
+    {
+        throw runtime_error("empty list of line segments");
+    }
+
+    // work in coordinates scaled by the half diagonal so that both
+    // coefficients are of order one; k1 = k1s / s^2 and k2 = k2s / s^4.
+    double cx = m_imageSize.width / 2.0;
+    double cy = m_imageSize.height / 2.0;
+    double s = getNormalizationScale(m_imageSize);
+
+    // the linearization only holds near the solution and outlier groups
+    // can throw a full step far past it, so a step is kept only when it
+    // lowers the `GetFMin` cost, halved a few times before giving up.
+    CostEvaluator evaluator(segments, mMakeCameraProps(0.0, 0.0), m_numDistParams);
+    double cost = evaluator.evaluate(0.0, 0.0);
+
+    double k1s = 0.0, k2s = 0.0;
+    for (int iter = 0; iter < INIT_GUESS_ITERATIONS; iter++)
+    {
+        double n11 = 0.0, n12 = 0.0, n22 = 0.0, g1 = 0.0, g2 = 0.0;
+        for (auto &group : segments)
+        {
+            // undistorted endpoints and their derivatives w.r.t. (k1s, k2s)
+            vector<cv::Point2d> points, dk1, dk2;
+            for (auto &line : group)
+            {
+                cv::Point2d ends[2] = {cv::Point2d(line.sx, line.sy), cv::Point2d(line.ex, line.ey)};
+                for (auto &end : ends)
+                {
+                    double x = (end.x - cx) / s;
+                    double y = (end.y - cy) / s;
+                    double dscale1 = 0.0, dscale2 = 0.0;
+                    double scale = getUndistortScale(sqrt(x * x + y * y), k1s, k2s, m_model, &dscale1, &dscale2);
+
+                    points.push_back(cv::Point2d(x * scale, y * scale));
+                    dk1.push_back(cv::Point2d(x * dscale1, y * dscale1));
+                    dk2.push_back(cv::Point2d(x * dscale2, y * dscale2));
+                }
+            }
+
+            size_t n = points.size();
+            if (n < 3)
+            {
+                continue;
+            }
+
+            // total least squares line through the group
+            cv::Point2d centroid(0.0, 0.0);
+            for (auto &p : points)
+            {
+                centroid = centroid + p;
+            }
+            centroid = centroid * (1.0 / n);
+
+            double sxx = 0.0, sxy = 0.0, syy = 0.0;
+            for (auto &p : points)
+            {
+                sxx += (p.x - centroid.x) * (p.x - centroid.x);
+                sxy += (p.x - centroid.x) * (p.y - centroid.y);
+                syy += (p.y - centroid.y) * (p.y - centroid.y);
+            }
+            double theta = 0.5 * atan2(2.0 * sxy, sxx - syy);
+            cv::Point2d dir(cos(theta), sin(theta));
+            cv::Point2d normal(-dir.y, dir.x);
+
+            // residuals and their linearization. the line offset and
+            // rotation are free, so project out span{1, t} per group.
+            vector<double> e(n), a1(n), a2(n), t(n);
+            double tt = 0.0;
+            for (size_t i = 0; i < n; i++)
+            {
+                cv::Point2d rel = points[i] - centroid;
+                e[i] = normal.dot(rel);
+                t[i] = dir.dot(rel);
+                a1[i] = normal.dot(dk1[i]);
+                a2[i] = normal.dot(dk2[i]);
+                tt += t[i] * t[i];
+            }
+
+            vector<double> *columns[3] = {&e, &a1, &a2};
+            for (auto column : columns)
+            {
+                double mean = 0.0, proj = 0.0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    mean += (*column)[i];
+                    proj += (*column)[i] * t[i];
+                }
+                mean /= n;
+                proj = (tt > 0.0) ? proj / tt : 0.0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    (*column)[i] -= mean + proj * t[i];
+                }
+            }
+
+            for (size_t i = 0; i < n; i++)
+            {
+                n11 += a1[i] * a1[i];
+                n12 += a1[i] * a2[i];
+                n22 += a2[i] * a2[i];
+                g1 += a1[i] * e[i];
+                g2 += a2[i] * e[i];
+            }
+        }
+
+        double step1 = 0.0, step2 = 0.0;
+        double det = n11 * n22 - n12 * n12;
+        if (m_numDistParams > 1 && det > 1e-9 * n11 * n22)
+        {
+            step1 = -(n22 * g1 - n12 * g2) / det;
+            step2 = -(n11 * g2 - n12 * g1) / det;
+        }
+        else if (n11 > 0.0)
+        {
+            // one parameter model, or k2 is not observable from these lines
+            step1 = -g1 / n11;
+        }
+        else
+        {
+            break;
+        }
+
+        bool lowered = false;
+        for (int halving = 0; halving < INIT_GUESS_HALVINGS; halving++)
+        {
+            double stepCost = evaluator.evaluate((k1s + step1) / (s * s), (k2s + step2) / (s * s * s * s));
+            if (stepCost < cost)
+            {
+                cost = stepCost;
+                lowered = true;
+                break;
+            }
+            step1 /= 2.0;
+            step2 /= 2.0;
+        }
+        if (!lowered)
+        {
+            break;
+        }
+
+        k1s += step1;
+        k2s += step2;
+
+        if (fabs(step1) + fabs(step2) < INIT_GUESS_TOLERANCE)
+        {
+            break;
+        }
+    }
+
+    return mMakeCameraProps(k1s / (s * s), k2s / (s * s * s * s));
+}
+
+} // namespace distrect
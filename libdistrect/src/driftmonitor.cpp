@@ -0,0 +1,108 @@
+#include <libdistrect.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace distrect
+{
+CalibrationDriftMonitor::CalibrationDriftMonitor(int sampleInterval, double ratioThres)
+    : m_sampleInterval(sampleInterval), m_ratioThres(ratioThres)
+{
+    if (sampleInterval < 1)
+    {
+        throw runtime_error("sample interval must be positive");
+    }
+
+    reset();
+}
+
+CalibrationDriftMonitor::~CalibrationDriftMonitor() {}
+
+void CalibrationDriftMonitor::reset()
+{
+    m_frameCount = 0;
+    m_samplesAbove = 0;
+    m_status = drift_status();
+}
+
+drift_status CalibrationDriftMonitor::getStatus()
+{
+    return m_status;
+}
+
+bool CalibrationDriftMonitor::addFrame(const cv::Mat &frame)
+{
+    if ((m_frameCount++ % m_sampleInterval) != 0 || m_status.recalibrate)
+    {
+        return m_status.recalibrate;
+    }
+
+    double error = 0.0;
+    if (!mMeasure(frame, error))
+    {
+        return m_status.recalibrate;
+    }
+
+    m_status.lastError = error;
+    m_status.samples++;
+
+    if (m_status.samples <= DRIFT_BASELINE_SAMPLES)
+    {
+        // running mean until the baseline is complete
+        m_status.baseline += (error - m_status.baseline) / m_status.samples;
+        m_status.current = m_status.baseline;
+        return false;
+    }
+
+    m_status.current += DRIFT_SMOOTHING * (error - m_status.current);
+
+    double threshold = max(m_status.baseline * m_ratioThres, m_status.baseline + DRIFT_MIN_ERROR);
+    m_samplesAbove = (m_status.current > threshold) ? m_samplesAbove + 1 : 0;
+    if (m_samplesAbove >= DRIFT_TRIGGER_SAMPLES)
+    {
+        cout << "calibration drift detected. residual " << m_status.current
+             << " against baseline " << m_status.baseline << endl;
+        m_status.recalibrate = true;
+    }
+
+    return m_status.recalibrate;
+}
+
+bool CalibrationDriftMonitor::mMeasure(const cv::Mat &frame, double &error)
+{
+    if (frame.empty())
+    {
+        return false;
+    }
+
+    if (!m_rectifier)
+    {
+        m_rectifier.reset(new DistortionRectifier());
+    }
+    m_rectifier->setImage(frame);
+
+    // the output is already rectified, so grade it with no distortion at all
+    camera_props identity = makeCameraProps(frame.size());
+
+    try
+    {
+        LineSegmentList segments = m_rectifier->getLineSegments();
+        LineSegmentList filteredSegments = m_rectifier->filterLineSegments(segments);
+        LineSegmentList groupedSegments = m_rectifier->groupLineSegments(filteredSegments);
+        if (groupedSegments.size() < MIN_NUM_OF_SELECTED_LINE_GROUPS)
+        {
+            return false;
+        }
+
+        error = getLineGroupsError(groupedSegments, identity);
+    }
+    catch (const runtime_error &)
+    {
+        // nothing usable in this frame
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace distrect
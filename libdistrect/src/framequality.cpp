@@ -0,0 +1,185 @@
+#include <libdistrect.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace distrect
+{
+frame_quality DistortionRectifier::scoreFrame()
+{
+    if (m_curGrayImage.empty())
+    {
+        throw runtime_error("image is not set. please set the image first.");
+    }
+
+    frame_quality quality = frame_quality();
+    quality.numLineChains = -1;
+    quality.numLines = -1;
+
+    double scale = min(1.0, double(QUALITY_SCORE_WIDTH) / m_curGrayImage.cols);
+    cv::Mat smallImage;
+    cv::resize(m_curGrayImage, smallImage, cv::Size(), scale, scale, cv::INTER_AREA);
+    if (smallImage.depth() != CV_8U)
+    {
+        cv::normalize(smallImage, smallImage, 0, 255, cv::NORM_MINMAX, CV_8U);
+    }
+
+    cv::Mat gradX, gradY, magnitude, angle;
+    cv::Sobel(smallImage, gradX, CV_32F, 1, 0);
+    cv::Sobel(smallImage, gradY, CV_32F, 0, 1);
+    cv::cartToPolar(gradX, gradY, magnitude, angle, true);
+
+    // lines close to the center barely bend, so weight everything by the
+    // normalized distance from the image center.
+    double cx = smallImage.cols / 2.0;
+    double cy = smallImage.rows / 2.0;
+    double maxRadius = sqrt(cx * cx + cy * cy);
+
+    vector<double> histogram(QUALITY_ORIENTATION_BINS, 0.0);
+    double energy = 0.0;
+    double histogramTotal = 0.0;
+    for (int row = 0; row < magnitude.rows; row++)
+    {
+        const float *magRow = magnitude.ptr<float>(row);
+        const float *angRow = angle.ptr<float>(row);
+        double dy = row - cy;
+        for (int col = 0; col < magnitude.cols; col++)
+        {
+            double dx = col - cx;
+            double weight = sqrt(dx * dx + dy * dy) / maxRadius;
+            energy += magRow[col] * weight;
+
+            if (magRow[col] < QUALITY_EDGE_MAG_THRES)
+            {
+                continue;
+            }
+
+            // edge orientation doesn't depend on the gradient sign
+            int bin = int(scalar_mod<double>(angRow[col], 180.0) / 180.0 * QUALITY_ORIENTATION_BINS);
+            bin = min(bin, QUALITY_ORIENTATION_BINS - 1);
+            histogram[bin] += magRow[col] * weight;
+            histogramTotal += magRow[col] * weight;
+        }
+    }
+
+    quality.gradientEnergy = energy / double(magnitude.rows * magnitude.cols);
+
+    double entropy = 0.0;
+    if (histogramTotal > 0.0)
+    {
+        for (auto value : histogram)
+        {
+            if (value > 0.0)
+            {
+                double p = value / histogramTotal;
+                entropy -= p * log(p);
+            }
+        }
+        entropy /= log(double(QUALITY_ORIENTATION_BINS));
+    }
+    quality.orientationSpread = entropy;
+
+    quality.score = (quality.gradientEnergy / QUALITY_MIN_GRADIENT_ENERGY) * quality.orientationSpread;
+    if (quality.gradientEnergy < QUALITY_MIN_GRADIENT_ENERGY)
+    {
+        quality.rejection = FRAME_LOW_GRADIENT_ENERGY;
+    }
+    else if (quality.orientationSpread < QUALITY_MIN_ORIENTATION_SPREAD)
+    {
+        quality.rejection = FRAME_NARROW_ORIENTATIONS;
+    }
+    else
+    {
+        quality.rejection = FRAME_ACCEPTED;
+    }
+    quality.usable = quality.rejection == FRAME_ACCEPTED;
+
+    return quality;
+}
+
+frame_quality DistortionRectifier::scoreLineSegments(LineSegmentList segments, frame_quality quality)
+{
+    quality.numLineChains = (int)segments.size();
+    quality.numLines = 0;
+    quality.totalLineLength = 0.0;
+    for (auto cell : segments)
+    {
+        for (auto curLine : cell)
+        {
+            quality.totalLineLength += sqrt(pow(curLine.sx - curLine.ex, 2.0) + pow(curLine.sy - curLine.ey, 2.0));
+            quality.numLines++;
+        }
+    }
+
+    quality.score *= quality.totalLineLength / QUALITY_MIN_LINE_LENGTH;
+    // keep the reason of a frame `scoreFrame` already rejected
+    if (quality.rejection == FRAME_ACCEPTED)
+    {
+        if (quality.numLineChains == 0)
+        {
+            quality.rejection = FRAME_NO_LINES;
+        }
+        else if (quality.numLineChains < QUALITY_MIN_LINE_CHAINS)
+        {
+            quality.rejection = FRAME_FEW_LINE_CHAINS;
+        }
+        else if (quality.totalLineLength < QUALITY_MIN_LINE_LENGTH)
+        {
+            quality.rejection = FRAME_SHORT_LINES;
+        }
+    }
+    quality.usable = quality.rejection == FRAME_ACCEPTED;
+
+    return quality;
+}
+
+CalibrationFrameBudget::CalibrationFrameBudget(int windowSize, int framesPerWindow)
+    : m_windowSize(windowSize), m_framesPerWindow(framesPerWindow), m_framesSeen(0)
+{
+    if (windowSize < 1 || framesPerWindow < 1)
+    {
+        throw runtime_error("window size and frames per window must be positive");
+    }
+}
+
+CalibrationFrameBudget::~CalibrationFrameBudget() {}
+
+bool CalibrationFrameBudget::push(const cv::Mat &frame, const frame_quality &quality)
+{
+    m_framesSeen++;
+
+    if (quality.usable && !frame.empty())
+    {
+        bool isFull = (int)m_best.size() >= m_framesPerWindow;
+        if (!isFull || quality.score > m_best.back().first)
+        {
+            if (isFull)
+            {
+                m_best.pop_back();
+            }
+
+            auto pos = find_if(m_best.begin(), m_best.end(), [&quality](const pair<double, cv::Mat> &item) {
+                return item.first < quality.score;
+            });
+            m_best.insert(pos, make_pair(quality.score, frame.clone()));
+        }
+    }
+
+    return m_framesSeen >= m_windowSize;
+}
+
+vector<cv::Mat> CalibrationFrameBudget::popSelected()
+{
+    vector<cv::Mat> frames;
+    for (auto item : m_best)
+    {
+        frames.push_back(item.second);
+    }
+
+    m_best.clear();
+    m_framesSeen = 0;
+
+    return frames;
+}
+
+} // namespace distrect
@@ -0,0 +1,359 @@
+#include <framering.hpp>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace distrect
+{
+static size_t alignUp(size_t value)
+{
+    return (value + FRAME_RING_ALIGN - 1) / FRAME_RING_ALIGN * FRAME_RING_ALIGN;
+}
+
+static uint32_t getProcessId()
+{
+#ifdef _WIN32
+    return (uint32_t)GetCurrentProcessId();
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+#ifndef _WIN32
+// true for a frame ring of this version whose producer is gone. anything
+// else under the name, including a live producer, is left alone.
+static bool isStaleRing(const string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool stale = false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(ring_header))
+    {
+        void *data = mmap(NULL, sizeof(ring_header), PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            const ring_header *header = (const ring_header *)data;
+            if (header->magic == FRAME_RING_MAGIC && header->version == FRAME_RING_VERSION)
+            {
+                stale = (kill((pid_t)header->ownerPid, 0) != 0 && errno == ESRCH);
+            }
+            munmap(data, sizeof(ring_header));
+        }
+    }
+    close(fd);
+
+    return stale;
+}
+#endif
+
+SharedMemoryRegion::SharedMemoryRegion(const string &name, size_t size, bool create)
+    : m_name(name), m_size(size), m_data(nullptr), m_owner(create), m_handle(nullptr)
+{
+#ifdef _WIN32
+    HANDLE handle;
+    if (create)
+    {
+        handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                    DWORD(uint64_t(size) >> 32), DWORD(size & 0xffffffff), name.c_str());
+    }
+    else
+    {
+        handle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    }
+    if (handle == NULL)
+    {
+        throw runtime_error("can't open shared memory " + name);
+    }
+    if (create && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        // the mapping lives as long as any handle, so another producer or
+        // readers of an earlier one still have it. its size and layout are
+        // fixed, and readers would see the header change under them.
+        CloseHandle(handle);
+        throw runtime_error("shared memory " + name + " is still open by another process");
+    }
+
+    void *data = MapViewOfFile(handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+    if (data == NULL)
+    {
+        CloseHandle(handle);
+        throw runtime_error("can't map shared memory " + name);
+    }
+
+    if (m_size == 0)
+    {
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(data, &info, sizeof(info));
+        m_size = info.RegionSize;
+    }
+    m_handle = handle;
+    m_data = (uint8_t *)data;
+#else
+    int fd = create ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600)
+                    : shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0 && create && errno == EEXIST)
+    {
+        if (!isStaleRing(name))
+        {
+            throw runtime_error("shared memory " + name + " is in use and not a ring left behind by a finished producer");
+        }
+
+        // a crashed producer left the name behind. readers still mapping
+        // it keep their copy and see no new frames until they reopen.
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        throw runtime_error("can't open shared memory " + name);
+    }
+
+    if (create && ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error("can't resize shared memory " + name);
+    }
+
+    if (m_size == 0)
+    {
+        struct stat info;
+        fstat(fd, &info);
+        m_size = (size_t)info.st_size;
+    }
+
+    void *data = mmap(NULL, m_size, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        if (create)
+        {
+            shm_unlink(name.c_str());
+        }
+        throw runtime_error("can't map shared memory " + name);
+    }
+    m_data = (uint8_t *)data;
+#endif
+}
+
+SharedMemoryRegion::~SharedMemoryRegion()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle((HANDLE)m_handle);
+#else
+    munmap(m_data, m_size);
+    if (m_owner)
+    {
+        shm_unlink(m_name.c_str());
+    }
+#endif
+}
+
+uint8_t *SharedMemoryRegion::data()
+{
+    return m_data;
+}
+
+size_t SharedMemoryRegion::size()
+{
+    return m_size;
+}
+
+static size_t getRingBytes(cv::Size size, int type, int slotCount, uint64_t &slotStride, uint64_t &dataOffset, uint64_t &dataBytes)
+{
+    dataOffset = alignUp(sizeof(ring_slot_header));
+    dataBytes = uint64_t(size.width) * size.height * CV_ELEM_SIZE(type);
+    slotStride = alignUp(size_t(dataOffset + dataBytes));
+    return alignUp(sizeof(ring_header)) + size_t(slotStride) * slotCount;
+}
+
+static size_t getRingBytes(cv::Size size, int type, int slotCount)
+{
+    uint64_t slotStride, dataOffset, dataBytes;
+    return getRingBytes(size, type, slotCount, slotStride, dataOffset, dataBytes);
+}
+
+FrameRingWriter::FrameRingWriter(const string &name, cv::Size size, int type, int slotCount)
+    : m_region(name, getRingBytes(size, type, max(slotCount, 1)), true), m_nextSequence(1), m_writing(false)
+{
+    if (slotCount < 2)
+    {
+        throw runtime_error("frame ring needs at least two slots");
+    }
+
+    m_header = new (m_region.data()) ring_header;
+    m_header->version = FRAME_RING_VERSION;
+    m_header->slotCount = (uint32_t)slotCount;
+    m_header->rows = size.height;
+    m_header->cols = size.width;
+    m_header->type = type;
+    m_header->ownerPid = getProcessId();
+    getRingBytes(size, type, slotCount, m_header->slotStride, m_header->dataOffset, m_header->dataBytes);
+
+    uint8_t *slots = m_region.data() + alignUp(sizeof(ring_header));
+    for (int i = 0; i < slotCount; i++)
+    {
+        ring_slot_header *slot = new (slots + i * m_header->slotStride) ring_slot_header;
+        slot->version.store(0, memory_order_relaxed);
+        slot->sequence = 0;
+        slot->timestamp = 0;
+    }
+
+    // readers check the magic first, write it last
+    m_header->published.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    m_header->magic = FRAME_RING_MAGIC;
+}
+
+FrameRingWriter::~FrameRingWriter() {}
+
+cv::Mat FrameRingWriter::beginWrite()
+{
+    uint8_t *slotBase = m_region.data() + alignUp(sizeof(ring_header)) +
+                        (m_nextSequence % m_header->slotCount) * m_header->slotStride;
+    ring_slot_header *slot = (ring_slot_header *)slotBase;
+
+    if (!m_writing)
+    {
+        // odd version, readers holding this slot will fail to validate
+        slot->version.fetch_add(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        m_writing = true;
+    }
+
+    return cv::Mat(m_header->rows, m_header->cols, m_header->type, slotBase + m_header->dataOffset);
+}
+
+uint64_t FrameRingWriter::commit(int64_t timestamp)
+{
+    if (!m_writing)
+    {
+        throw runtime_error("nothing to commit. call beginWrite first.");
+    }
+
+    ring_slot_header *slot = (ring_slot_header *)(m_region.data() + alignUp(sizeof(ring_header)) +
+                                                  (m_nextSequence % m_header->slotCount) * m_header->slotStride);
+    slot->sequence = m_nextSequence;
+    slot->timestamp = timestamp;
+    slot->version.fetch_add(1, memory_order_release);
+    m_header->published.store(m_nextSequence, memory_order_release);
+
+    m_writing = false;
+    return m_nextSequence++;
+}
+
+FrameRingReader::FrameRingReader(const string &name)
+    : m_region(name, 0, false)
+{
+    if (m_region.size() < sizeof(ring_header))
+    {
+        throw runtime_error("shared memory " + name + " is not a frame ring");
+    }
+
+    m_header = (ring_header *)m_region.data();
+    bool isRing = (m_header->magic == FRAME_RING_MAGIC);
+    atomic_thread_fence(memory_order_acquire);
+    if (!isRing || m_header->version != FRAME_RING_VERSION)
+    {
+        throw runtime_error("shared memory " + name + " is not a frame ring or has another version");
+    }
+}
+
+FrameRingReader::~FrameRingReader() {}
+
+uint64_t FrameRingReader::getPublishedSequence()
+{
+    return m_header->published.load(memory_order_acquire);
+}
+
+ring_slot_header *FrameRingReader::mGetSlot(uint64_t sequence)
+{
+    return (ring_slot_header *)(m_region.data() + alignUp(sizeof(ring_header)) +
+                                (sequence % m_header->slotCount) * m_header->slotStride);
+}
+
+bool FrameRingReader::acquire(uint64_t sequence, frame_view &view)
+{
+    uint64_t published = getPublishedSequence();
+    if (sequence == 0)
+    {
+        sequence = published;
+    }
+    if (sequence == 0 || sequence > published)
+    {
+        return false;
+    }
+
+    ring_slot_header *slot = mGetSlot(sequence);
+    uint64_t version = slot->version.load(memory_order_acquire);
+    if ((version & 1) != 0 || slot->sequence != sequence)
+    {
+        return false;
+    }
+
+    view.sequence = sequence;
+    view.timestamp = slot->timestamp;
+    view.version = version;
+    view.image = cv::Mat(m_header->rows, m_header->cols, m_header->type, (uint8_t *)slot + m_header->dataOffset);
+
+    // the header fields above may be torn, so check them once more
+    return validate(view);
+}
+
+bool FrameRingReader::validate(const frame_view &view)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return mGetSlot(view.sequence)->version.load(memory_order_relaxed) == view.version;
+}
+
+bool FrameRingReader::read(uint64_t sequence, frame_view &view)
+{
+    for (int attempt = 0; attempt < 2 * (int)m_header->slotCount; attempt++)
+    {
+        frame_view shared;
+        if (!acquire(sequence, shared))
+        {
+            if (sequence != 0)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        view.image = shared.image.clone();
+        view.sequence = shared.sequence;
+        view.timestamp = shared.timestamp;
+        view.version = shared.version;
+        if (validate(shared))
+        {
+            return true;
+        }
+        if (sequence != 0)
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+} // namespace distrect
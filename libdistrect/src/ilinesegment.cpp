@@ -3,15 +3,28 @@
 namespace distrect
 {
 	ILineSegment::ILineSegment()
-		: a(0.0), b(0.0), invert(false), sx(0.0), sy(0.0), ex(0.0), ey(0.0), segmentNo(0)
+		: a(0.0), b(0.0), sx(0.0), sy(0.0), ex(0.0), ey(0.0), segmentNo(0), invert(false)
 	{
 	}
 
 	ILineSegment::ILineSegment(const ILineSegment &il)
-		: a(il.a), b(il.b), invert(il.invert), sx(il.sx), sy(il.sy), ex(il.ex), ey(il.ey), segmentNo(il.segmentNo)
+		: a(il.a), b(il.b), sx(il.sx), sy(il.sy), ex(il.ex), ey(il.ey), segmentNo(il.segmentNo), invert(il.invert)
 	{
 	}
 
 	ILineSegment::~ILineSegment() {}
 
+	ILineSegment &ILineSegment::operator=(const ILineSegment &il)
+	{
+		a = il.a;
+		b = il.b;
+		invert = il.invert;
+		sx = il.sx;
+		sy = il.sy;
+		ex = il.ex;
+		ey = il.ey;
+		segmentNo = il.segmentNo;
+		return *this;
+	}
+
 } // namespace distrect
\ No newline at end of file
@@ -0,0 +1,281 @@
+#include <jointcalib.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace distrect
+{
+JointCalibrator::JointCalibrator(distortion_model model, int numParams)
+    : m_model(model), m_numParams(numParams), m_scale(1.0), m_evaluations(0)
+{
+    if (numParams < 1 || numParams > 2)
+    {
+        throw runtime_error("number of distortion parameters must be 1 or 2");
+    }
+
+    m_solution[0] = 0.0;
+    m_solution[1] = 0.0;
+}
+
+JointCalibrator::~JointCalibrator() {}
+
+int JointCalibrator::addImage(const LineSegmentList &groups, cv::Size imageSize)
+{
+    if (m_evaluators.empty())
+    {
+        m_imageSize = imageSize;
+        // both coefficients of similar magnitude for the simplex
+        m_scale = getNormalizationScale(imageSize);
+    }
+    else if (imageSize != m_imageSize)
+    {
+        throw runtime_error("all images must have the same size");
+    }
+
+    // only the intrinsics and the model are used by the evaluator
+    camera_props props = mMakeCameraProps(0.0, 0.0);
+    m_evaluators.push_back(unique_ptr<CostEvaluator>(new CostEvaluator(groups, props, m_numParams)));
+    m_groupCounts.push_back(m_evaluators.back()->getGroupCount());
+    m_active.push_back(true);
+    m_costs.push_back(0.0);
+
+    return (int)m_evaluators.size() - 1;
+}
+
+int JointCalibrator::addImage(DistortionRectifier &rectifier, const cv::Mat &image)
+{
+    rectifier.setImage(image);
+    LineSegmentList segments = rectifier.getLineSegments();
+    segments = rectifier.filterLineSegments(segments);
+    segments = rectifier.groupLineSegments(segments);
+    segments = rectifier.selectLineSegmentGroups(segments);
+
+    return addImage(segments, image.size());
+}
+
+double JointCalibrator::mEvaluate(const double *x)
+{
+    double k1 = x[0] / pow(m_scale, 2);
+    double k2 = (m_numParams > 1) ? x[1] / pow(m_scale, 4) : 0.0;
+
+    // one shard per image, every evaluator is used by a single thread
+    cv::parallel_for_(cv::Range(0, (int)m_evaluators.size()), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++)
+        {
+            if (m_active[i])
+            {
+                m_costs[i] = m_evaluators[i]->evaluate(k1, k2);
+            }
+        }
+    });
+    m_evaluations++;
+
+    // mean over all groups of the active images
+    double sum = 0.0;
+    int noGroups = 0;
+    for (size_t i = 0; i < m_costs.size(); i++)
+    {
+        if (m_active[i])
+        {
+            sum += m_costs[i] * m_groupCounts[i];
+            noGroups += m_groupCounts[i];
+        }
+    }
+
+    return sum / noGroups;
+}
+
+void JointCalibrator::mMinimize()
+{
+    // Nelder-Mead with the reflection, expansion, contraction and shrink
+    // coefficients of fminsearch (1, 2, 0.5, 0.5), but not its defaults:
+    // the first simplex steps an absolute JOINT_SIMPLEX_STEP where
+    // fminsearch takes 5% of the start point, and it stops at the tighter
+    // JOINT_TOLERANCE instead of TolX = TolFun = 1e-4.
+    const int n = m_numParams;
+    vector<vector<double>> simplex(n + 1, vector<double>(m_solution, m_solution + n));
+    vector<double> costs(n + 1);
+    for (int i = 0; i < n; i++)
+    {
+        simplex[i + 1][i] += JOINT_SIMPLEX_STEP;
+    }
+    for (int i = 0; i <= n; i++)
+    {
+        costs[i] = mEvaluate(simplex[i].data());
+    }
+
+    vector<int> order(n + 1);
+    vector<double> centroid(n), reflected(n), trial(n);
+    for (int iteration = 0; iteration < JOINT_MAX_ITERATIONS; iteration++)
+    {
+        for (int i = 0; i <= n; i++)
+        {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&](int a, int b) { return costs[a] < costs[b]; });
+        int best = order[0], worst = order[n], secondWorst = order[n - 1];
+
+        double spread = 0.0;
+        for (int i = 0; i <= n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                spread = max(spread, abs(simplex[i][j] - simplex[best][j]));
+            }
+        }
+        if (spread <= JOINT_TOLERANCE && costs[worst] - costs[best] <= JOINT_TOLERANCE)
+        {
+            break;
+        }
+
+        for (int j = 0; j < n; j++)
+        {
+            centroid[j] = 0.0;
+            for (int i = 0; i <= n; i++)
+            {
+                if (i != worst)
+                {
+                    centroid[j] += simplex[i][j] / n;
+                }
+            }
+            reflected[j] = 2.0 * centroid[j] - simplex[worst][j];
+        }
+        double reflectedCost = mEvaluate(reflected.data());
+
+        if (reflectedCost < costs[best])
+        {
+            for (int j = 0; j < n; j++)
+            {
+                trial[j] = 3.0 * centroid[j] - 2.0 * simplex[worst][j];
+            }
+            double expandedCost = mEvaluate(trial.data());
+            if (expandedCost < reflectedCost)
+            {
+                simplex[worst] = trial;
+                costs[worst] = expandedCost;
+            }
+            else
+            {
+                simplex[worst] = reflected;
+                costs[worst] = reflectedCost;
+            }
+            continue;
+        }
+        if (reflectedCost < costs[secondWorst])
+        {
+            simplex[worst] = reflected;
+            costs[worst] = reflectedCost;
+            continue;
+        }
+
+        // contract outside or inside, shrink towards the best if neither helps
+        bool outside = reflectedCost < costs[worst];
+        for (int j = 0; j < n; j++)
+        {
+            trial[j] = outside ? 1.5 * centroid[j] - 0.5 * simplex[worst][j]
+                               : 0.5 * centroid[j] + 0.5 * simplex[worst][j];
+        }
+        double contractedCost = mEvaluate(trial.data());
+        if (contractedCost < (outside ? reflectedCost : costs[worst]))
+        {
+            simplex[worst] = trial;
+            costs[worst] = contractedCost;
+            continue;
+        }
+
+        for (int i = 0; i <= n; i++)
+        {
+            if (i == best)
+            {
+                continue;
+            }
+            for (int j = 0; j < n; j++)
+            {
+                simplex[i][j] = 0.5 * (simplex[best][j] + simplex[i][j]);
+            }
+            costs[i] = mEvaluate(simplex[i].data());
+        }
+    }
+
+    int best = int(min_element(costs.begin(), costs.end()) - costs.begin());
+    for (int j = 0; j < n; j++)
+    {
+        m_solution[j] = simplex[best][j];
+    }
+}
+
+camera_props JointCalibrator::solve()
+{
+    if (m_evaluators.empty())
+    {
+        throw runtime_error("no image added. call addImage first.");
+    }
+
+    mMinimize();
+    while (true)
+    {
+        // per image costs at the solution
+        mEvaluate(m_solution);
+
+        vector<double> active;
+        int worst = -1;
+        for (size_t i = 0; i < m_costs.size(); i++)
+        {
+            if (!m_active[i])
+            {
+                continue;
+            }
+            active.push_back(m_costs[i]);
+            if (worst < 0 || m_costs[i] > m_costs[worst])
+            {
+                worst = (int)i;
+            }
+        }
+        if ((int)active.size() <= JOINT_MIN_IMAGES)
+        {
+            break;
+        }
+
+        nth_element(active.begin(), active.begin() + active.size() / 2, active.end());
+        double median = active[active.size() / 2];
+        if (m_costs[worst] <= JOINT_OUTLIER_RATIO * median)
+        {
+            break;
+        }
+
+        // the evaluators stay as they are, only the shard is skipped
+        cout << "dropping image " << worst << " with cost " << m_costs[worst] << " (median " << median << ")" << endl;
+        m_active[worst] = false;
+        mMinimize();
+    }
+
+    return mMakeCameraProps(m_solution[0] / pow(m_scale, 2), m_solution[1] / pow(m_scale, 4));
+}
+
+camera_props JointCalibrator::mMakeCameraProps(double k1, double k2)
+{
+    return makeCameraProps(m_imageSize, m_model, k1, (m_numParams > 1) ? k2 : 0.0);
+}
+
+int JointCalibrator::getImageCount() const
+{
+    return (int)m_evaluators.size();
+}
+
+bool JointCalibrator::isImageActive(int index) const
+{
+    return m_active.at(index);
+}
+
+double JointCalibrator::getImageError(int index) const
+{
+    return m_costs.at(index);
+}
+
+long JointCalibrator::getEvaluationCount() const
+{
+    return m_evaluations;
+}
+
+} // namespace distrect
@@ -1,4 +1,7 @@
 #include <libdistrect.hpp>
+#include <distkernels.hpp>
+#include <mapcache.hpp>
+#include <pipelinerecord.hpp>
 #include <algorithm>
 #include <limits>
 
@@ -7,13 +10,27 @@ using namespace std;
 namespace distrect
 {
 DistortionRectifier::DistortionRectifier()
+    : m_pendingJobs(0), m_jobRunning(false), m_control(nullptr), m_bestError(numeric_limits<double>::max()),
+      m_model(DIST_MODEL_POLYNOMIAL), m_numDistParams(2),
+      m_useInitialGuess(true), m_hasWarmStart(false), m_costEvaluations(0),
+      m_tilesX(1), m_tilesY(1), m_tileOverlap(DETECTION_TILE_OVERLAP),
+      m_incremental(false), m_framesSinceFull(0),
+      m_refreshInterval(INCREMENTAL_REFRESH_FRAMES), m_incrementalStatus()
 {
-    m_matlabEngine = matlab::engine::startMATLAB();
+    MatlabEnginePool::instance().attachClient();
 }
 
 DistortionRectifier::~DistortionRectifier()
 {
-    matlab::engine::terminateEngineClient();
+    // queued calibrations still reference this instance
+    unique_lock<mutex> lock(m_jobsMutex);
+    m_jobsDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+
+    // the engines have to go while the client is still up, the last
+    // rectifier to detach terminates it
+    m_worker.reset();
+    m_matlabEngine.reset();
+    MatlabEnginePool::instance().detachClient();
 }
 
 void DistortionRectifier::setImage(const cv::Mat image)
@@ -51,6 +68,9 @@ void DistortionRectifier::mSetImage(cv::Mat image)
 
     // set curImage
     m_curImage = image.clone();
+    m_imageSize = image.size();
+    m_hasWarmStart = false;
+    mBeginRecordedFrame();
 
     // set grayImage
     m_curGrayImage = image.clone();
@@ -95,14 +115,31 @@ LineSegmentList DistortionRectifier::getLineSegments()
         throw runtime_error("nothing to do. image is not set or empty.");
     }
 
+    int64_t startTicks = cv::getTickCount();
+    LineSegmentList segments = m_incremental ? mGetIncrementalLineSegments() : mDetectLineSegments();
+    mRecord(STAGE_DETECT, segments, startTicks);
+
+    return segments;
+}
+
+LineSegmentList DistortionRectifier::mDetectLineSegments()
+{
+    if (m_tilesX * m_tilesY > 1)
+    {
+        return mGetTiledLineSegments();
+    }
+
     vector<matlab::data::Array> args;
     args.push_back(getMatlabImage(m_curGrayImage));
     args.push_back(m_arrayFactory.createScalar<int>(m_curGrayImage.rows));
     args.push_back(m_arrayFactory.createScalar<int>(m_curGrayImage.cols));
-    matlab::data::TypedArray<double> temp = m_matlabEngine->feval(
-        matlab::engine::convertUTF8StringToUTF16String("EDPFLinesmex"),
-        args);
+    matlab::data::TypedArray<double> temp = mFeval("EDPFLinesmex", args);
+
+    return mChainLineSegments(mParseLineSegments(temp));
+}
 
+vector<ILineSegment> DistortionRectifier::mParseLineSegments(matlab::data::TypedArray<double> &temp)
+{
     size_t noLines = temp.getDimensions()[1];
     vector<ILineSegment> lineSegments;
     for (size_t i = 0; i < noLines; i++)
@@ -120,6 +157,11 @@ LineSegmentList DistortionRectifier::getLineSegments()
         lineSegments.push_back(segment);
     }
 
+    return lineSegments;
+}
+
+LineSegmentList DistortionRectifier::mChainLineSegments(const vector<ILineSegment> &lineSegments)
+{
     LineSegmentList segments;
 
     int curEdgeSeg = -1;
@@ -156,12 +198,13 @@ LineSegmentList DistortionRectifier::filterLineSegments(LineSegmentList segments
         throw runtime_error("empty list of line segments found");
     }
 
-    if (m_curGrayImage.empty())
+    if (m_imageSize.area() == 0)
     {
         throw runtime_error("image is not set");
     }
 
-    cv::Point3_<double> imageCenter(m_curGrayImage.cols / 2.0f, m_curGrayImage.rows / 2.0f, 1.0);
+    int64_t startTicks = cv::getTickCount();
+    cv::Point3_<double> imageCenter(m_imageSize.width / 2.0f, m_imageSize.height / 2.0f, 1.0);
     LineSegmentList outLineGroup;
     for (auto cell : segments)
     {
@@ -202,6 +245,7 @@ LineSegmentList DistortionRectifier::filterLineSegments(LineSegmentList segments
         }
     }
 
+    mRecord(STAGE_FILTER, outLineGroup, startTicks);
     return outLineGroup;
 }
 
@@ -212,6 +256,7 @@ LineSegmentList DistortionRectifier::groupLineSegments(LineSegmentList segments,
         throw runtime_error("empty line segment list found");
     }
 
+    int64_t startTicks = cv::getTickCount();
     LineSegmentList outLineGroup;
     for (int groupIx = 0; groupIx < segments.size(); groupIx++)
     {
@@ -335,6 +380,8 @@ LineSegmentList DistortionRectifier::groupLineSegments(LineSegmentList segments,
             outLineGroup.push_back(tmpGroup);
         }
     }
+
+    mRecord(STAGE_GROUP, outLineGroup, startTicks);
     return outLineGroup;
 }
 
@@ -418,13 +465,25 @@ matlab::data::CellArray DistortionRectifier::mGetLineSegments(LineSegmentList se
 
 LineSegmentList DistortionRectifier::selectLineSegmentGroups(LineSegmentList segments)
 {
-    if (m_curGrayImage.empty())
+    if (m_imageSize.area() == 0)
     {
         throw runtime_error("image not set. please set image and find the line groups first.");
     }
 
+    int64_t startTicks = cv::getTickCount();
     LineSegmentList lineGroups(segments);
-    matlab::data::Array mImage = getMatlabImage(m_curGrayImage);
+    matlab::data::Array mImageSize = mGetMatlabImageSize();
+    m_bestError = numeric_limits<double>::max();
+
+    // seed every solve with the closed form estimate, then with the
+    // solution of the previous, slightly larger set of groups.
+    double seed[2] = {0.0, 0.0};
+    if (m_useInitialGuess && !lineGroups.empty())
+    {
+        camera_props initialProps = getInitialCameraParams(lineGroups);
+        seed[0] = initialProps.distortion_params.at<float>(0, 0);
+        seed[1] = initialProps.distortion_params.at<float>(0, 1);
+    }
 
     while (true)
     {
@@ -433,18 +492,26 @@ LineSegmentList DistortionRectifier::selectLineSegmentGroups(LineSegmentList seg
             break;
         }
 
-        matlab::data::CellArray mLineGroups = mGetLineSegments(lineGroups);
-        matlab::data::TypedArray<double> minErrorT = m_matlabEngine->feval(
-            matlab::engine::convertUTF8StringToUTF16String("GetFMin"),
-            vector<matlab::data::Array>({mImage, mLineGroups}));
+        mCheckpoint();
+
+        matlab::data::TypedArray<double> minErrorT = mGetFMin(mImageSize, lineGroups, m_useInitialGuess ? seed : nullptr);
 
         double minError = minErrorT[2][0]; // the 3rd row is the fval
+        if (minError < m_bestError)
+        {
+            m_bestError = minError;
+            m_bestProps = mMakeCameraProps(minErrorT[0][0], minErrorT[1][0]);
+        }
+        seed[0] = minErrorT[0][0];
+        seed[1] = minErrorT[1][0];
 
         LineSegmentList origLineGroup(lineGroups);
 
         int indToEliminate = -1;
         for (int i = 0; i < origLineGroup.size(); i++)
         {
+            mCheckpoint();
+
             lineGroups.clear();
 
             for (int j = 0; j < origLineGroup.size(); j++)
@@ -455,10 +522,7 @@ LineSegmentList DistortionRectifier::selectLineSegmentGroups(LineSegmentList seg
                 }
             }
 
-            matlab::data::CellArray tmpMLineGroups = mGetLineSegments(lineGroups);
-            matlab::data::TypedArray<double> tmpErrorT = m_matlabEngine->feval(
-                matlab::engine::convertUTF8StringToUTF16String("GetFMin"),
-                vector<matlab::data::Array>({mImage, tmpMLineGroups}));
+            matlab::data::TypedArray<double> tmpErrorT = mGetFMin(mImageSize, lineGroups, m_useInitialGuess ? seed : nullptr);
 
             double tmpError = tmpErrorT[2][0];
             if (tmpError < minError)
@@ -488,41 +552,217 @@ LineSegmentList DistortionRectifier::selectLineSegmentGroups(LineSegmentList seg
         }
     }
 
+    if (m_useInitialGuess)
+    {
+        m_warmStart[0] = seed[0];
+        m_warmStart[1] = seed[1];
+        m_hasWarmStart = true;
+    }
+
+    mRecord(STAGE_SELECT, lineGroups, startTicks);
     return lineGroups;
 }
 
 camera_props DistortionRectifier::getCameraParams(LineSegmentList segments)
 {
-    if (m_curGrayImage.empty())
+    if (m_imageSize.area() == 0)
     {
         throw runtime_error("image is not set. please set the image first.");
     }
 
-    camera_props props;
-    props.intrinsic_matrix = cv::Mat(3, 3, CV_32F, cv::Scalar(0.0));
-    props.intrinsic_matrix.at<float>(0, 0) = 1.0f;
-    props.intrinsic_matrix.at<float>(0, 2) = float(m_curGrayImage.cols) / 2.0f;
-    props.intrinsic_matrix.at<float>(1, 1) = 1.0f;
-    props.intrinsic_matrix.at<float>(1, 2) = float(m_curGrayImage.rows) / 2.0f;
-    props.intrinsic_matrix.at<float>(2, 2) = 1.0f;
+    int64_t startTicks = cv::getTickCount();
+    matlab::data::Array mImageSize = mGetMatlabImageSize();
 
-    matlab::data::Array mImage = getMatlabImage(m_curGrayImage);
-    matlab::data::CellArray mLineGroups = mGetLineSegments(segments);
+    double seed[2] = {0.0, 0.0};
+    if (m_useInitialGuess)
+    {
+        if (m_hasWarmStart)
+        {
+            seed[0] = m_warmStart[0];
+            seed[1] = m_warmStart[1];
+        }
+        else
+        {
+            camera_props initialProps = getInitialCameraParams(segments);
+            seed[0] = initialProps.distortion_params.at<float>(0, 0);
+            seed[1] = initialProps.distortion_params.at<float>(0, 1);
+        }
+    }
 
     matlab::data::TypedArray<double>
-        params = m_matlabEngine->feval(
-            matlab::engine::convertUTF8StringToUTF16String("GetFMin"),
-            vector<matlab::data::Array>({mImage,
-                                         mLineGroups}));
+        params = mGetFMin(mImageSize, segments, m_useInitialGuess ? seed : nullptr);
 
-    props.distortion_params = cv::Mat(1, 4, CV_32F, cv::Scalar(0.0));
-    props.distortion_params.at<float>(0, 0) = (float)params[0][0];
-    props.distortion_params.at<float>(0, 1) = (float)params[1][0];
+    camera_props props = mMakeCameraProps(params[0][0], params[1][0]);
+    mRecord(props, startTicks);
 
     return props;
 }
 
+matlab::data::TypedArray<double> DistortionRectifier::mGetFMin(const matlab::data::Array &mImageSize, LineSegmentList segments, const double *seed)
+{
+    // the start point also tells GetFMin how many parameters to estimate
+    matlab::data::TypedArray<double> x0 = m_arrayFactory.createArray<double>({(size_t)m_numDistParams, 1});
+    for (int i = 0; i < m_numDistParams; i++)
+    {
+        x0[i][0] = (seed != nullptr) ? seed[i] : 0.0;
+    }
+
+    vector<matlab::data::Array> args({mImageSize, mGetLineSegments(segments), x0, m_arrayFactory.createScalar<double>(m_model)});
+    if (seed != nullptr)
+    {
+        // seeds are ~1e-7 in pixels, far below the simplex step and TolX
+        // of fminsearch, so search in the half-diagonal scaled coefficients
+        // of getInitialCameraParams. cold starts keep the original search.
+        args.push_back(m_arrayFactory.createScalar<double>(getNormalizationScale(m_imageSize)));
+    }
+
+    matlab::data::TypedArray<double> result = mFeval("GetFMin", args);
+    m_costEvaluations += (long)(double)result[3][0]; // the 4th row is the number of cost evaluations
+
+    return result;
+}
+
+matlab::data::Array DistortionRectifier::mGetMatlabImageSize()
+{
+    // `GetFMin` only needs the image center, no need to copy the pixels
+    return m_arrayFactory.createArray<double>({1, 2}, {double(m_imageSize.height), double(m_imageSize.width)});
+}
+
+void DistortionRectifier::setDistortionModel(distortion_model model, int numParams)
+{
+    if (numParams < 1 || numParams > 2)
+    {
+        throw runtime_error("number of distortion parameters must be 1 or 2");
+    }
+
+    m_model = model;
+    m_numDistParams = numParams;
+    m_hasWarmStart = false;
+}
+
+void DistortionRectifier::setInitialGuess(bool enabled)
+{
+    m_useInitialGuess = enabled;
+    m_hasWarmStart = false;
+}
+
+long DistortionRectifier::getCostEvaluationCount()
+{
+    return m_costEvaluations;
+}
+
+void DistortionRectifier::resetCostEvaluationCount()
+{
+    m_costEvaluations = 0;
+}
+
+void DistortionRectifier::setMapCache(shared_ptr<RectifyMapCache> cache)
+{
+    m_mapCache = cache;
+}
+
+void DistortionRectifier::setImageSize(cv::Size size)
+{
+    // the stages after detection only use the image size. no frame is
+    // started on the recorder, there is nothing to record for it
+    m_curImage.release();
+    m_curGrayImage.release();
+    m_imageSize = size;
+    m_hasWarmStart = false;
+}
+
+void DistortionRectifier::setRecorder(shared_ptr<PipelineRecorder> recorder)
+{
+    m_recorder = recorder;
+    m_recorderError.clear();
+
+    // the current image gets its frame too, otherwise the next stage
+    // would write to a recorder without one
+    mBeginRecordedFrame();
+}
+
+string DistortionRectifier::getRecorderError()
+{
+    return m_recorderError;
+}
+
+void DistortionRectifier::mBeginRecordedFrame()
+{
+    if (!m_recorder || m_curImage.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        m_recorder->beginFrame(m_curImage.size());
+    }
+    catch (const exception &e)
+    {
+        mStopRecording(e);
+    }
+}
+
+void DistortionRectifier::mStopRecording(const exception &e)
+{
+    // the record is a side output, a full disk or a broken file must not
+    // take the calibration down with it
+    m_recorder.reset();
+    m_recorderError = e.what();
+}
+
+void DistortionRectifier::mRecord(pipeline_stage stage, const LineSegmentList &segments, int64_t startTicks)
+{
+    if (!m_recorder)
+    {
+        return;
+    }
+
+    double seconds = double(cv::getTickCount() - startTicks) / cv::getTickFrequency();
+    try
+    {
+        m_recorder->writeSegments(stage, segments);
+        m_recorder->writeTiming(stage, seconds);
+    }
+    catch (const exception &e)
+    {
+        mStopRecording(e);
+    }
+}
+
+void DistortionRectifier::mRecord(const camera_props &props, int64_t startTicks)
+{
+    if (!m_recorder)
+    {
+        return;
+    }
+
+    double seconds = double(cv::getTickCount() - startTicks) / cv::getTickFrequency();
+    try
+    {
+        m_recorder->writeProps(props);
+        m_recorder->writeTiming(STAGE_ESTIMATE, seconds);
+    }
+    catch (const exception &e)
+    {
+        mStopRecording(e);
+    }
+}
+
+camera_props DistortionRectifier::mMakeCameraProps(double k1, double k2)
+{
+    return makeCameraProps(m_imageSize, m_model, k1, (m_numDistParams > 1) ? k2 : 0.0);
+}
+
 cv::Mat DistortionRectifier::undistort(camera_props props, double alpha)
+{
+    cv::Mat rv;
+    undistort(props, rv, alpha);
+
+    return rv;
+}
+
+void DistortionRectifier::undistort(camera_props props, cv::Mat &dst, double alpha)
 {
     if (m_curImage.empty())
     {
@@ -532,14 +772,49 @@ cv::Mat DistortionRectifier::undistort(camera_props props, double alpha)
     {
         throw runtime_error("alpha must be between " + to_string(UNDIST_VALID) + " to " + to_string(UNDIST_FULL));
     }
+    if (!dst.empty() && (dst.size() != m_curImage.size() || dst.type() != m_curImage.type()))
+    {
+        // reallocating would leave e.g. a ring slot with its old contents
+        throw runtime_error("output image doesn't match the size or type of the current image");
+    }
 
-    cv::Mat newCamMat = cv::getOptimalNewCameraMatrix(props.intrinsic_matrix, props.distortion_params, m_curGrayImage.size(), alpha);
+    if (m_mapCache)
+    {
+        shared_ptr<const rectify_map> map = m_mapCache->get(props, m_curImage.size(), alpha);
+        dst.create(m_curImage.size(), m_curImage.type());
+        remapImage(*map, m_curImage, dst);
+        return;
+    }
 
-    cv::Mat rv;
-    //cv::undistort(m_curImage, rv, props.intrinsic_matrix, props.distortion_params);
-    cv::undistort(m_curImage, rv, props.intrinsic_matrix, props.distortion_params, newCamMat);
+    cv::Mat newCamMat = getRectifyCameraMatrix(props, m_curGrayImage.size(), alpha);
 
-    return rv;
+    // the kernel is picked once for the pixel type, model and number of
+    // active coefficients, then rectifies bands straight from the model
+    remap_kernel kernel = selectRemapKernel(m_curImage.type(), props.model, getActiveParamCount(props));
+    kernels::lens_t<float> lens = kernels::getLens<float>(props);
+    kernels::lens_t<float> newLens = kernels::getNewLens<float>(newCamMat);
+
+    // no-op if dst was given, so shared memory outputs stay in place
+    dst.create(m_curImage.size(), m_curImage.type());
+    int noBands = (dst.rows + REMAP_BAND_ROWS - 1) / REMAP_BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, noBands), [&](const cv::Range &range) {
+        cv::Mat mapX, mapY;
+        for (int band = range.start; band < range.end; band++)
+        {
+            int rowStart = band * REMAP_BAND_ROWS;
+            int rowEnd = min(rowStart + REMAP_BAND_ROWS, dst.rows);
+            if (kernel != nullptr)
+            {
+                kernel(m_curImage, dst, lens, newLens, rowStart, rowEnd);
+                continue;
+            }
+
+            // no kernel for this type, e.g. CV_8UC4 or CV_16S
+            getRectifyMapRows(props, newCamMat, rowStart, rowEnd, dst.cols, mapX, mapY);
+            cv::Mat dstBand = dst.rowRange(rowStart, rowEnd);
+            cv::remap(m_curImage, dstBand, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar());
+        }
+    });
 }
 
 cv::Mat DistortionRectifier::undistort()
@@ -549,14 +824,56 @@ cv::Mat DistortionRectifier::undistort()
         throw runtime_error("image is not set.");
     }
 
+    camera_props props = mRunPipeline();
+
+    return undistort(props);
+}
+
+string DistortionRectifier::mGetRejectionMessage(frame_rejection rejection)
+{
+    switch (rejection)
+    {
+    case FRAME_LOW_GRADIENT_ENERGY:
+        return "image is not suitable for calibration. not enough edges away from the center.";
+    case FRAME_NARROW_ORIENTATIONS:
+        return "image is not suitable for calibration. edges run in too few directions.";
+    case FRAME_NO_LINES:
+        return "image is not suitable for calibration. no line segments found.";
+    case FRAME_FEW_LINE_CHAINS:
+        return "image is not suitable for calibration. too few off-center edge chains.";
+    case FRAME_SHORT_LINES:
+        return "image is not suitable for calibration. not enough long off-center lines.";
+    default:
+        return "image is suitable for calibration.";
+    }
+}
+
+camera_props DistortionRectifier::mRunPipeline()
+{
+    frame_quality quality = scoreFrame();
+    if (!quality.usable)
+    {
+        throw runtime_error(mGetRejectionMessage(quality.rejection));
+    }
+
     LineSegmentList segments = getLineSegments();
-    LineSegmentList filteredSegments = filterLineSegments(segments);
+    mCheckpoint();
+    // filterLineSegments throws on an empty detection, the gate rejects
+    // it with a reason of its own instead
+    LineSegmentList filteredSegments = segments.empty() ? segments : filterLineSegments(segments);
+
+    quality = scoreLineSegments(filteredSegments, quality);
+    if (!quality.usable)
+    {
+        throw runtime_error(mGetRejectionMessage(quality.rejection));
+    }
+
     LineSegmentList groupedSegments = groupLineSegments(filteredSegments);
+    mCheckpoint();
     LineSegmentList finalSegments = selectLineSegmentGroups(groupedSegments);
+    mCheckpoint();
 
-    camera_props props = getCameraParams(finalSegments);
-
-    return undistort(props);
+    return getCameraParams(finalSegments);
 }
 
 } // namespace distrect
\ No newline at end of file
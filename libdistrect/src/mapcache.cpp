@@ -0,0 +1,289 @@
+#include <mapcache.hpp>
+#include <distkernels.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace distrect
+{
+rectify_map getRectifyMap(const camera_props &props, cv::Size imageSize, double alpha, int gridStep)
+{
+    if (gridStep < 1)
+    {
+        throw runtime_error("grid step must be positive");
+    }
+
+    cv::Mat newCamMat = getRectifyCameraMatrix(props, imageSize, alpha);
+    kernels::lens_t<float> lens = kernels::getLens<float>(props);
+    kernels::lens_t<float> newLens = kernels::getNewLens<float>(newCamMat);
+
+    // node (i, j) is output pixel (i * step, j * step), so the grid is
+    // the map of a camera scaled down by the step
+    newLens.fx /= gridStep;
+    newLens.fy /= gridStep;
+    newLens.cx /= gridStep;
+    newLens.cy /= gridStep;
+
+    rectify_map rv;
+    int gridCols = (imageSize.width + gridStep - 2) / gridStep + 1;
+    int gridRows = (imageSize.height + gridStep - 2) / gridStep + 1;
+    rv.mapX.create(gridRows, gridCols, CV_32F);
+    rv.mapY.create(gridRows, gridCols, CV_32F);
+    selectMapKernel(props.model, getActiveParamCount(props))(lens, newLens, 0, gridRows, rv.mapX, rv.mapY);
+    rv.size = imageSize;
+    rv.gridStep = gridStep;
+    rv.bytes = size_t(gridRows) * gridCols * 2 * sizeof(float);
+
+    if (gridStep > 1)
+    {
+        // unreachable radii get a scale of 1e6, interpolating towards such
+        // a node would smear it over the valid pixels of the cell
+        vector<bool> invalidRows(gridRows, false);
+        for (int row = 0; row < gridRows; row++)
+        {
+            const float *x = rv.mapX.ptr<float>(row);
+            const float *y = rv.mapY.ptr<float>(row);
+            for (int col = 0; col < gridCols && !invalidRows[row]; col++)
+            {
+                // written so that NaN counts as invalid too
+                invalidRows[row] = !(x[col] > -imageSize.width && x[col] < 2 * imageSize.width &&
+                                     y[col] > -imageSize.height && y[col] < 2 * imageSize.height);
+            }
+        }
+        rv.exactCellRows.assign(gridRows, 0);
+        bool anyExact = false;
+        for (int row = 0; row < gridRows; row++)
+        {
+            rv.exactCellRows[row] = (invalidRows[row] || invalidRows[min(row + 1, gridRows - 1)]) ? 1 : 0;
+            anyExact = anyExact || rv.exactCellRows[row];
+        }
+        if (anyExact)
+        {
+            rv.props.intrinsic_matrix = props.intrinsic_matrix.clone();
+            rv.props.distortion_params = props.distortion_params.clone();
+            rv.props.model = props.model;
+            rv.newCameraMatrix = newCamMat;
+        }
+        else
+        {
+            rv.exactCellRows.clear();
+        }
+    }
+
+    return rv;
+}
+
+static void expandGridRows(const rectify_map &map, int rowStart, int rowEnd, cv::Mat &mapX, cv::Mat &mapY)
+{
+    const int step = map.gridStep;
+    const float invStep = 1.0f / step;
+    const int lastCol = map.mapX.cols - 1;
+    const int lastRow = map.mapX.rows - 1;
+
+    vector<int> nodeCols(map.size.width);
+    vector<float> weightCols(map.size.width);
+    for (int col = 0; col < map.size.width; col++)
+    {
+        nodeCols[col] = col / step;
+        weightCols[col] = (col - nodeCols[col] * step) * invStep;
+    }
+
+    mapX.create(rowEnd - rowStart, map.size.width, CV_32F);
+    mapY.create(rowEnd - rowStart, map.size.width, CV_32F);
+    for (int row = rowStart; row < rowEnd; row++)
+    {
+        int node = row / step;
+        float ay = (row - node * step) * invStep;
+        const float *x0 = map.mapX.ptr<float>(node);
+        const float *x1 = map.mapX.ptr<float>(min(node + 1, lastRow));
+        const float *y0 = map.mapY.ptr<float>(node);
+        const float *y1 = map.mapY.ptr<float>(min(node + 1, lastRow));
+        if (!map.exactCellRows.empty() && map.exactCellRows[node])
+        {
+            // same size and type, so the row headers keep pointing into the band
+            cv::Mat rowX = mapX.row(row - rowStart);
+            cv::Mat rowY = mapY.row(row - rowStart);
+            getRectifyMapRows(map.props, map.newCameraMatrix, row, row + 1, map.size.width, rowX, rowY);
+            continue;
+        }
+        float *outX = mapX.ptr<float>(row - rowStart);
+        float *outY = mapY.ptr<float>(row - rowStart);
+        for (int col = 0; col < map.size.width; col++)
+        {
+            int i = nodeCols[col];
+            int j = min(i + 1, lastCol);
+            float ax = weightCols[col];
+            float topX = x0[i] + ax * (x0[j] - x0[i]);
+            float bottomX = x1[i] + ax * (x1[j] - x1[i]);
+            float topY = y0[i] + ax * (y0[j] - y0[i]);
+            float bottomY = y1[i] + ax * (y1[j] - y1[i]);
+            outX[col] = topX + ay * (bottomX - topX);
+            outY[col] = topY + ay * (bottomY - topY);
+        }
+    }
+}
+
+void remapImage(const rectify_map &map, const cv::Mat &src, cv::Mat &dst)
+{
+    if (src.size() != map.size)
+    {
+        throw runtime_error("map and image sizes differ");
+    }
+
+    dst.create(src.size(), src.type());
+    int noBands = (dst.rows + REMAP_BAND_ROWS - 1) / REMAP_BAND_ROWS;
+    cv::parallel_for_(cv::Range(0, noBands), [&](const cv::Range &range) {
+        cv::Mat mapX, mapY;
+        for (int band = range.start; band < range.end; band++)
+        {
+            int rowStart = band * REMAP_BAND_ROWS;
+            int rowEnd = min(rowStart + REMAP_BAND_ROWS, dst.rows);
+            if (map.gridStep == 1)
+            {
+                mapX = map.mapX.rowRange(rowStart, rowEnd);
+                mapY = map.mapY.rowRange(rowStart, rowEnd);
+            }
+            else
+            {
+                expandGridRows(map, rowStart, rowEnd, mapX, mapY);
+            }
+
+            cv::Mat dstBand = dst.rowRange(rowStart, rowEnd);
+            cv::remap(src, dstBand, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar());
+        }
+    });
+}
+
+RectifyMapCache::RectifyMapCache(size_t byteBudget, int gridStep)
+    : m_byteBudget(byteBudget), m_gridStep(gridStep)
+{
+    if (gridStep < 1)
+    {
+        throw runtime_error("grid step must be positive");
+    }
+}
+
+RectifyMapCache::~RectifyMapCache() {}
+
+size_t RectifyMapCache::map_key_hash::operator()(const map_key &key) const
+{
+    size_t seed = size_t(key.propsHash);
+    seed ^= hash<int>()(key.width) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    seed ^= hash<int>()(key.height) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    seed ^= hash<double>()(key.alpha) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+RectifyMapCache::map_key RectifyMapCache::mMakeKey(const camera_props &props, cv::Size imageSize, double alpha)
+{
+    // FNV-1a over the values the map depends on
+    map_key key;
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash, &key](float value) {
+        key.props.push_back(value);
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(value); i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            mix(props.intrinsic_matrix.at<float>(row, col));
+        }
+    }
+    for (int col = 0; col < props.distortion_params.cols; col++)
+    {
+        mix(props.distortion_params.at<float>(0, col));
+    }
+    hash = (hash ^ uint64_t(props.model)) * 1099511628211ULL;
+
+    key.propsHash = hash;
+    key.model = int(props.model);
+    key.width = imageSize.width;
+    key.height = imageSize.height;
+    key.alpha = alpha;
+    return key;
+}
+
+shared_ptr<const rectify_map> RectifyMapCache::get(const camera_props &props, cv::Size imageSize, double alpha)
+{
+    map_key key = mMakeKey(props, imageSize, alpha);
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto found = m_index.find(key);
+        if (found != m_index.end())
+        {
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            m_stats.hits++;
+            return found->second->second;
+        }
+        m_stats.misses++;
+    }
+
+    // other cameras stay served while this one is computed
+    shared_ptr<const rectify_map> map = make_shared<rectify_map>(getRectifyMap(props, imageSize, alpha, m_gridStep));
+
+    lock_guard<mutex> lock(m_mutex);
+    auto found = m_index.find(key);
+    if (found != m_index.end())
+    {
+        // computed concurrently by another caller
+        return found->second->second;
+    }
+    if (map->bytes <= m_byteBudget)
+    {
+        m_entries.push_front(entry(key, map));
+        m_index[key] = m_entries.begin();
+        m_stats.bytes += map->bytes;
+        mEvict();
+    }
+
+    return map;
+}
+
+void RectifyMapCache::setByteBudget(size_t byteBudget)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_byteBudget = byteBudget;
+    mEvict();
+}
+
+map_cache_stats RectifyMapCache::getStats()
+{
+    lock_guard<mutex> lock(m_mutex);
+    map_cache_stats rv = m_stats;
+    rv.entries = m_entries.size();
+    return rv;
+}
+
+void RectifyMapCache::clear()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+    m_stats.bytes = 0;
+}
+
+void RectifyMapCache::resetStats()
+{
+    lock_guard<mutex> lock(m_mutex);
+    size_t bytes = m_stats.bytes;
+    m_stats = map_cache_stats();
+    m_stats.bytes = bytes;
+}
+
+void RectifyMapCache::mEvict()
+{
+    while (m_stats.bytes > m_byteBudget && !m_entries.empty())
+    {
+        m_stats.bytes -= m_entries.back().second->bytes;
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+        m_stats.evictions++;
+    }
+}
+
+} // namespace distrect
@@ -0,0 +1,386 @@
+#include <pipelinerecord.hpp>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace distrect
+{
+static uint64_t alignRecord(uint64_t value)
+{
+    return (value + 7) / 8 * 8;
+}
+
+PipelineRecorder::PipelineRecorder(const string &path)
+    : m_file(path, ios::binary | ios::trunc), m_frameCount(0)
+{
+    if (!m_file)
+    {
+        throw runtime_error("can't create record file " + path);
+    }
+
+    record_file_header header;
+    header.magic = RECORD_MAGIC;
+    header.version = RECORD_VERSION;
+    header.reserved = 0;
+    m_file.write((const char *)&header, sizeof(header));
+}
+
+PipelineRecorder::~PipelineRecorder() {}
+
+void PipelineRecorder::mWriteChunk(record_tag tag, pipeline_stage stage, const vector<const void *> &parts, const vector<size_t> &sizes)
+{
+    if (m_frameCount == 0)
+    {
+        throw runtime_error("no frame started. call beginFrame first.");
+    }
+
+    record_chunk_header header;
+    header.tag = (uint16_t)tag;
+    header.stage = (uint16_t)stage;
+    header.frame = m_frameCount - 1;
+    header.size = 0;
+    for (auto size : sizes)
+    {
+        header.size += size;
+    }
+
+    m_file.write((const char *)&header, sizeof(header));
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        m_file.write((const char *)parts[i], sizes[i]);
+    }
+
+    const char padding[8] = {0};
+    m_file.write(padding, alignRecord(header.size) - header.size);
+    if (!m_file)
+    {
+        throw runtime_error("can't write to the record file");
+    }
+}
+
+void PipelineRecorder::beginFrame(cv::Size size)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_frameCount++;
+
+    int32_t payload[2] = {size.width, size.height};
+    mWriteChunk(RECORD_FRAME, STAGE_DETECT, {payload}, {sizeof(payload)});
+}
+
+void PipelineRecorder::writeSegments(pipeline_stage stage, const LineSegmentList &segments)
+{
+    // chain lengths are padded to keep the lines 8 byte aligned
+    vector<uint32_t> counts(2 + alignRecord(4 * segments.size()) / 4, 0);
+    vector<record_line> lines;
+    counts[0] = (uint32_t)segments.size();
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        counts[2 + i] = (uint32_t)segments[i].size();
+        for (auto &segment : segments[i])
+        {
+            record_line line;
+            line.a = segment.a;
+            line.b = segment.b;
+            line.sx = segment.sx;
+            line.sy = segment.sy;
+            line.ex = segment.ex;
+            line.ey = segment.ey;
+            line.segmentNo = segment.segmentNo;
+            line.invert = segment.invert ? 1 : 0;
+            lines.push_back(line);
+        }
+    }
+    counts[1] = (uint32_t)lines.size();
+
+    lock_guard<mutex> lock(m_mutex);
+    mWriteChunk(RECORD_SEGMENTS, stage, {counts.data(), lines.data()},
+                {counts.size() * sizeof(uint32_t), lines.size() * sizeof(record_line)});
+}
+
+void PipelineRecorder::writeProps(const camera_props &props)
+{
+    record_props payload;
+    memset(&payload, 0, sizeof(payload));
+    payload.model = (uint32_t)props.model;
+    payload.noDistParams = (uint32_t)min(props.distortion_params.cols, RECORD_MAX_DIST_PARAMS);
+    for (int i = 0; i < 9; i++)
+    {
+        payload.intrinsic[i] = props.intrinsic_matrix.at<float>(i / 3, i % 3);
+    }
+    for (uint32_t i = 0; i < payload.noDistParams; i++)
+    {
+        payload.distortion[i] = props.distortion_params.at<float>(0, i);
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    mWriteChunk(RECORD_PROPS, STAGE_ESTIMATE, {&payload}, {sizeof(payload)});
+}
+
+void PipelineRecorder::writeTiming(pipeline_stage stage, double seconds)
+{
+    lock_guard<mutex> lock(m_mutex);
+    mWriteChunk(RECORD_TIMING, stage, {&seconds}, {sizeof(seconds)});
+}
+
+int PipelineRecorder::getFrameCount()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return (int)m_frameCount;
+}
+
+PipelineReplay::PipelineReplay(const string &path)
+    : m_data(nullptr), m_size(0), m_handle(nullptr)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw runtime_error("can't open record file " + path);
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    m_size = (size_t)fileSize.QuadPart;
+    HANDLE mapping = (m_size > 0) ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    CloseHandle(file);
+    if (mapping == NULL)
+    {
+        throw runtime_error("can't map record file " + path);
+    }
+
+    m_data = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m_data == NULL)
+    {
+        CloseHandle(mapping);
+        throw runtime_error("can't map record file " + path);
+    }
+    m_handle = mapping;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("can't open record file " + path);
+    }
+
+    struct stat info;
+    fstat(fd, &info);
+    m_size = (size_t)info.st_size;
+    void *data = (m_size > 0) ? mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw runtime_error("can't map record file " + path);
+    }
+    m_data = (uint8_t *)data;
+#endif
+
+    const record_file_header *header = (const record_file_header *)m_data;
+    if (m_size < sizeof(record_file_header) || header->magic != RECORD_MAGIC || header->version != RECORD_VERSION)
+    {
+        mUnmap();
+        throw runtime_error(path + " is not a record file or has another version");
+    }
+
+    uint64_t offset = sizeof(record_file_header);
+    while (offset + sizeof(record_chunk_header) <= m_size)
+    {
+        const record_chunk_header *chunk = (const record_chunk_header *)(m_data + offset);
+        uint64_t payload = offset + sizeof(record_chunk_header);
+        if (chunk->size > m_size - payload)
+        {
+            break;
+        }
+        offset = payload + alignRecord(chunk->size);
+
+        if (chunk->stage >= STAGE_COUNT)
+        {
+            continue;
+        }
+        if (chunk->frame > m_frames.size())
+        {
+            // frames are numbered in order, anything else is garbage
+            break;
+        }
+        if (chunk->frame == m_frames.size())
+        {
+            frame_index empty;
+            for (int i = 0; i < STAGE_COUNT; i++)
+            {
+                empty.segments[i] = 0;
+                empty.timing[i] = -1.0;
+            }
+            empty.props = 0;
+            m_frames.push_back(empty);
+        }
+
+        frame_index &frame = m_frames[chunk->frame];
+        switch (chunk->tag)
+        {
+        case RECORD_FRAME:
+            if (chunk->size >= 2 * sizeof(int32_t))
+            {
+                const int32_t *size = (const int32_t *)(m_data + payload);
+                frame.size = cv::Size(size[0], size[1]);
+            }
+            break;
+        case RECORD_SEGMENTS:
+            if (chunk->size >= 2 * sizeof(uint32_t))
+            {
+                const uint32_t *counts = (const uint32_t *)(m_data + payload);
+                if (8 + alignRecord(4 * uint64_t(counts[0])) + sizeof(record_line) * uint64_t(counts[1]) <= chunk->size)
+                {
+                    frame.segments[chunk->stage] = payload;
+                }
+            }
+            break;
+        case RECORD_PROPS:
+            if (chunk->size >= sizeof(record_props))
+            {
+                frame.props = payload;
+            }
+            break;
+        case RECORD_TIMING:
+            if (chunk->size >= sizeof(double))
+            {
+                frame.timing[chunk->stage] = *(const double *)(m_data + payload);
+            }
+            break;
+        default:
+            // chunks of later versions
+            break;
+        }
+    }
+}
+
+PipelineReplay::~PipelineReplay()
+{
+    mUnmap();
+}
+
+void PipelineReplay::mUnmap()
+{
+    if (m_data == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle((HANDLE)m_handle);
+#else
+    munmap(m_data, m_size);
+#endif
+    m_data = nullptr;
+}
+
+int PipelineReplay::getFrameCount()
+{
+    return (int)m_frames.size();
+}
+
+const PipelineReplay::frame_index &PipelineReplay::mGetFrame(int frame)
+{
+    if (frame < 0 || frame >= (int)m_frames.size())
+    {
+        throw runtime_error("frame " + to_string(frame) + " is not in the record");
+    }
+
+    return m_frames[frame];
+}
+
+cv::Size PipelineReplay::getImageSize(int frame)
+{
+    return mGetFrame(frame).size;
+}
+
+bool PipelineReplay::hasStage(int frame, pipeline_stage stage)
+{
+    const frame_index &index = mGetFrame(frame);
+    return (stage == STAGE_ESTIMATE) ? index.props != 0 : index.segments[stage] != 0;
+}
+
+const record_line *PipelineReplay::getLines(int frame, pipeline_stage stage, size_t &count)
+{
+    uint64_t payload = mGetFrame(frame).segments[stage];
+    count = 0;
+    if (payload == 0)
+    {
+        return nullptr;
+    }
+
+    const uint32_t *counts = (const uint32_t *)(m_data + payload);
+    count = counts[1];
+    return (const record_line *)(m_data + payload + 8 + alignRecord(4 * uint64_t(counts[0])));
+}
+
+LineSegmentList PipelineReplay::getSegments(int frame, pipeline_stage stage)
+{
+    size_t noLines;
+    const record_line *lines = getLines(frame, stage, noLines);
+    if (lines == nullptr)
+    {
+        throw runtime_error("stage " + to_string(stage) + " of frame " + to_string(frame) + " is not in the record");
+    }
+
+    const uint32_t *counts = (const uint32_t *)(m_data + mGetFrame(frame).segments[stage]);
+    LineSegmentList rv(counts[0]);
+    size_t next = 0;
+    for (uint32_t i = 0; i < counts[0]; i++)
+    {
+        for (uint32_t j = 0; j < counts[2 + i] && next < noLines; j++, next++)
+        {
+            ILineSegment segment;
+            segment.a = lines[next].a;
+            segment.b = lines[next].b;
+            segment.sx = lines[next].sx;
+            segment.sy = lines[next].sy;
+            segment.ex = lines[next].ex;
+            segment.ey = lines[next].ey;
+            segment.segmentNo = lines[next].segmentNo;
+            segment.invert = lines[next].invert != 0;
+            rv[i].push_back(segment);
+        }
+    }
+
+    return rv;
+}
+
+camera_props PipelineReplay::getCameraProps(int frame)
+{
+    uint64_t payload = mGetFrame(frame).props;
+    if (payload == 0)
+    {
+        throw runtime_error("camera properties of frame " + to_string(frame) + " are not in the record");
+    }
+
+    const record_props *recorded = (const record_props *)(m_data + payload);
+    camera_props rv;
+    rv.intrinsic_matrix = cv::Mat(3, 3, CV_32F);
+    for (int i = 0; i < 9; i++)
+    {
+        rv.intrinsic_matrix.at<float>(i / 3, i % 3) = float(recorded->intrinsic[i]);
+    }
+    rv.distortion_params = cv::Mat(1, max((int)recorded->noDistParams, 4), CV_32F, cv::Scalar(0.0));
+    for (uint32_t i = 0; i < recorded->noDistParams && i < (uint32_t)RECORD_MAX_DIST_PARAMS; i++)
+    {
+        rv.distortion_params.at<float>(0, i) = float(recorded->distortion[i]);
+    }
+    rv.model = (distortion_model)recorded->model;
+
+    return rv;
+}
+
+double PipelineReplay::getTiming(int frame, pipeline_stage stage)
+{
+    return mGetFrame(frame).timing[stage];
+}
+
+} // namespace distrect
@@ -0,0 +1,167 @@
+#include <streamrect.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace distrect
+{
+StreamingRectifier::StreamingRectifier(const camera_props &props, cv::Size imageSize, int type, double alpha, int bandRows)
+    : m_size(imageSize), m_type(type), m_bandRows(bandRows), m_props(props), m_received(0), m_nextBand(0)
+{
+    if (imageSize.width < 2 || imageSize.height < 2)
+    {
+        throw runtime_error("image is too small");
+    }
+    if (bandRows < 1)
+    {
+        throw runtime_error("band rows must be positive");
+    }
+    if (alpha > UNDIST_FULL || alpha < UNDIST_VALID)
+    {
+        throw runtime_error("alpha must be between " + to_string(UNDIST_VALID) + " to " + to_string(UNDIST_FULL));
+    }
+
+    m_newCameraMatrix = getRectifyCameraMatrix(props, imageSize, alpha);
+
+    // source row window of every band, one band of maps at a time
+    int noBands = (imageSize.height + bandRows - 1) / bandRows;
+    m_windows.resize(noBands);
+    for (int band = 0; band < noBands; band++)
+    {
+        int rowStart = band * bandRows;
+        int rowEnd = min(rowStart + bandRows, imageSize.height);
+        getRectifyMapRows(props, m_newCameraMatrix, rowStart, rowEnd, imageSize.width, m_mapX, m_mapY);
+
+        float minY = float(imageSize.height), maxY = -1.0f;
+        for (int row = 0; row < m_mapY.rows; row++)
+        {
+            const float *mapXRow = m_mapX.ptr<float>(row);
+            const float *mapYRow = m_mapY.ptr<float>(row);
+            for (int col = 0; col < m_mapY.cols; col++)
+            {
+                // samples outside the image don't need any rows
+                if (mapXRow[col] <= -1.0f || mapXRow[col] >= float(imageSize.width) ||
+                    mapYRow[col] <= -1.0f || mapYRow[col] >= float(imageSize.height))
+                {
+                    continue;
+                }
+                minY = min(minY, mapYRow[col]);
+                maxY = max(maxY, mapYRow[col]);
+            }
+        }
+
+        band_window &window = m_windows[band];
+        window.start = max(int(floor(minY)), 0);
+        window.end = min(int(floor(maxY)) + 2, imageSize.height);
+        if (window.end <= window.start)
+        {
+            window.start = window.end = 0;
+        }
+    }
+
+    // bands are emitted in order, so a band is ready once every band up
+    // to it is, and rows are kept while any later band still needs them
+    int ready = 0;
+    for (auto &window : m_windows)
+    {
+        ready = max(ready, window.end);
+        window.ready = ready;
+    }
+    int keepFrom = imageSize.height;
+    for (int band = noBands - 1; band >= 0; band--)
+    {
+        if (m_windows[band].end > m_windows[band].start)
+        {
+            keepFrom = min(keepFrom, m_windows[band].start);
+        }
+        m_windows[band].keepFrom = keepFrom;
+    }
+
+    m_capacity = 1;
+    for (auto &window : m_windows)
+    {
+        m_capacity = max(m_capacity, window.ready - min(window.keepFrom, window.ready));
+    }
+
+    m_buffer.create(2 * m_capacity, imageSize.width, type);
+    m_mapX.create(bandRows, imageSize.width, CV_32F);
+    m_mapY.create(bandRows, imageSize.width, CV_32F);
+    m_band.create(bandRows, imageSize.width, type);
+}
+
+StreamingRectifier::~StreamingRectifier() {}
+
+void StreamingRectifier::reset()
+{
+    m_received = 0;
+    m_nextBand = 0;
+}
+
+int StreamingRectifier::getBufferRows() const
+{
+    return m_capacity;
+}
+
+size_t StreamingRectifier::getWorkingMemory() const
+{
+    size_t rowBytes = size_t(m_size.width) * CV_ELEM_SIZE(m_type);
+    size_t mapBytes = size_t(m_size.width) * sizeof(float);
+
+    return 2 * size_t(m_capacity) * rowBytes + size_t(m_bandRows) * (rowBytes + 2 * mapBytes) +
+           m_windows.size() * sizeof(band_window);
+}
+
+void StreamingRectifier::push(const cv::Mat &rows, const band_sink &sink)
+{
+    if (rows.type() != m_type || rows.cols != m_size.width)
+    {
+        throw runtime_error("rows don't match the frame width or type");
+    }
+    if (m_received + rows.rows > m_size.height)
+    {
+        throw runtime_error("more rows than the frame height. call reset for a new frame.");
+    }
+
+    for (int i = 0; i < rows.rows; i++)
+    {
+        // the next pending band isn't ready yet, so this row fits
+        int slot = m_received % m_capacity;
+        cv::Mat first = m_buffer.row(slot);
+        cv::Mat second = m_buffer.row(slot + m_capacity);
+        rows.row(i).copyTo(first);
+        rows.row(i).copyTo(second);
+        m_received++;
+
+        while (m_nextBand < (int)m_windows.size() && m_windows[m_nextBand].ready <= m_received)
+        {
+            mEmitBand(m_nextBand++, sink);
+        }
+    }
+}
+
+void StreamingRectifier::mEmitBand(int band, const band_sink &sink)
+{
+    int rowStart = band * m_bandRows;
+    int rowEnd = min(rowStart + m_bandRows, m_size.height);
+    cv::Mat output = m_band.rowRange(0, rowEnd - rowStart);
+
+    const band_window &window = m_windows[band];
+    if (window.end <= window.start)
+    {
+        output.setTo(cv::Scalar::all(0));
+        sink(rowStart, output);
+        return;
+    }
+
+    cv::Mat mapX = m_mapX.rowRange(0, rowEnd - rowStart);
+    cv::Mat mapY = m_mapY.rowRange(0, rowEnd - rowStart);
+    getRectifyMapRows(m_props, m_newCameraMatrix, rowStart, rowEnd, m_size.width, mapX, mapY);
+    mapY.convertTo(mapY, CV_32F, 1.0, -window.start);
+
+    int slot = window.start % m_capacity;
+    cv::Mat source = m_buffer.rowRange(slot, slot + window.end - window.start);
+    cv::remap(source, output, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar());
+    sink(rowStart, output);
+}
+
+} // namespace distrect
@@ -0,0 +1,722 @@
+#include <libdistrect.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace distrect
+{
+typedef struct seam_piece_t
+{
+    vector<ILineSegment> lines;
+    int tile;
+} seam_piece;
+
+typedef struct seam_match_t
+{
+    // end ids are 2 * piece + (0 front, 1 back)
+    int end1, end2;
+    bool collinear;
+    double score;
+} seam_match;
+
+static double getLineLength(const ILineSegment &seg)
+{
+    return sqrt(pow(seg.ex - seg.sx, 2.0) + pow(seg.ey - seg.sy, 2.0));
+}
+
+// position of (x, y) along `seg`, and its distance to the line through `seg`
+static void projectOnLine(const ILineSegment &seg, double x, double y, double &along, double &across)
+{
+    double length = max(getLineLength(seg), numeric_limits<double>::epsilon());
+    double dx = (seg.ex - seg.sx) / length;
+    double dy = (seg.ey - seg.sy) / length;
+    along = (x - seg.sx) * dx + (y - seg.sy) * dy;
+    across = abs((y - seg.sy) * dx - (x - seg.sx) * dy);
+}
+
+// angle between the two lines regardless of their direction, in degrees
+static double getAxisAngleDifference(const ILineSegment &seg1, const ILineSegment &seg2)
+{
+    double diff = RAD_TO_DEG_MULT * abs(atan2(seg1.ey - seg1.sy, seg1.ex - seg1.sx) - atan2(seg2.ey - seg2.sy, seg2.ex - seg2.sx));
+    diff = fmod(diff, 180.0);
+    return min(diff, 180.0 - diff);
+}
+
+static bool isCollinear(const ILineSegment &seg1, const ILineSegment &seg2, double &score)
+{
+    const ILineSegment &longer = (getLineLength(seg1) >= getLineLength(seg2)) ? seg1 : seg2;
+    const ILineSegment &shorter = (&longer == &seg1) ? seg2 : seg1;
+
+    double s0, e0, sDist, eDist;
+    projectOnLine(longer, shorter.sx, shorter.sy, s0, sDist);
+    projectOnLine(longer, shorter.ex, shorter.ey, e0, eDist);
+    double gap = max(max(min(s0, e0) - getLineLength(longer), -max(s0, e0)), 0.0);
+
+    score = max(sDist, eDist);
+    return score <= SEAM_DIST_THRES && gap <= SEAM_JOIN_DIST;
+}
+
+static double getEndpointDistance(const ILineSegment &seg1, const ILineSegment &seg2)
+{
+    double starts = min(hypot(seg1.sx - seg2.sx, seg1.sy - seg2.sy), hypot(seg1.sx - seg2.ex, seg1.sy - seg2.ey));
+    double ends = min(hypot(seg1.ex - seg2.sx, seg1.ey - seg2.sy), hypot(seg1.ex - seg2.ex, seg1.ey - seg2.ey));
+    return min(starts, ends);
+}
+
+// union of two collinear lines, along the longer one
+static ILineSegment mergeCollinear(const ILineSegment &seg1, const ILineSegment &seg2)
+{
+    const ILineSegment &longer = (getLineLength(seg1) >= getLineLength(seg2)) ? seg1 : seg2;
+    double xs[4] = {seg1.sx, seg1.ex, seg2.sx, seg2.ex};
+    double ys[4] = {seg1.sy, seg1.ey, seg2.sy, seg2.ey};
+
+    int first = 0, last = 0;
+    double minAlong = numeric_limits<double>::max(), maxAlong = -numeric_limits<double>::max();
+    for (int i = 0; i < 4; i++)
+    {
+        double along, across;
+        projectOnLine(longer, xs[i], ys[i], along, across);
+        if (along < minAlong)
+        {
+            minAlong = along;
+            first = i;
+        }
+        if (along > maxAlong)
+        {
+            maxAlong = along;
+            last = i;
+        }
+    }
+
+    ILineSegment rv(longer);
+    rv.sx = xs[first];
+    rv.sy = ys[first];
+    rv.ex = xs[last];
+    rv.ey = ys[last];
+    return rv;
+}
+
+// whether the line fit of `seg` is x = a + b * y rather than y = a + b * x,
+// decided by which one its own endpoints lie on. both do for a = 0 and
+// b = 1, then the detector's transposed invert flag decides
+static bool isFitAlongY(const ILineSegment &seg)
+{
+    double errX = abs(seg.sx - (seg.a + seg.b * seg.sy)) + abs(seg.ex - (seg.a + seg.b * seg.ey));
+    double errY = abs(seg.sy - (seg.a + seg.b * seg.sx)) + abs(seg.ey - (seg.a + seg.b * seg.ex));
+    if (abs(errX - errY) <= 1e-9)
+    {
+        return !seg.invert;
+    }
+    return errX < errY;
+}
+
+static void shiftLineSegment(ILineSegment &segment, cv::Point offset)
+{
+    segment.a += isFitAlongY(segment) ? offset.x - segment.b * offset.y : offset.y - segment.b * offset.x;
+    segment.sx += offset.x;
+    segment.ex += offset.x;
+    segment.sy += offset.y;
+    segment.ey += offset.y;
+}
+
+// whether both endpoints of the lines are within `tolerance`, in either direction
+static bool isSameLine(const ILineSegment &seg1, const ILineSegment &seg2, double tolerance)
+{
+    bool forward = hypot(seg1.sx - seg2.sx, seg1.sy - seg2.sy) <= tolerance && hypot(seg1.ex - seg2.ex, seg1.ey - seg2.ey) <= tolerance;
+    bool backward = hypot(seg1.sx - seg2.ex, seg1.sy - seg2.ey) <= tolerance && hypot(seg1.ex - seg2.sx, seg1.ey - seg2.sy) <= tolerance;
+    return forward || backward;
+}
+
+// whether the line fits of both lines predict the same points at the
+// endpoints of `reference`
+static bool isSameFit(const ILineSegment &reference, const ILineSegment &other, double tolerance)
+{
+    bool alongY = isFitAlongY(reference);
+    if (alongY != isFitAlongY(other) || reference.invert != other.invert)
+    {
+        return false;
+    }
+
+    double t[2] = {alongY ? reference.sy : reference.sx, alongY ? reference.ey : reference.ex};
+    for (double v : t)
+    {
+        if (abs((reference.a + reference.b * v) - (other.a + other.b * v)) > tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether any part of `seg` lies in `region`, by clipping the line
+// against the four borders
+static bool isTouchingRegion(const ILineSegment &seg, const cv::Rect &region)
+{
+    double dx = seg.ex - seg.sx;
+    double dy = seg.ey - seg.sy;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {seg.sx - region.x, region.x + region.width - seg.sx, seg.sy - region.y, region.y + region.height - seg.sy};
+    double t0 = 0.0, t1 = 1.0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] == 0.0)
+        {
+            if (q[i] < 0.0)
+            {
+                return false;
+            }
+            continue;
+        }
+        double t = q[i] / p[i];
+        if (p[i] < 0.0)
+        {
+            t0 = max(t0, t);
+        }
+        else
+        {
+            t1 = min(t1, t);
+        }
+    }
+    return t0 <= t1;
+}
+
+// splits chains into pieces of consecutive lines inside (or outside)
+// `region`. a line is inside when its midpoint is, which gives each line
+// to exactly one tile, or with `touching` when any part of it is
+static void appendPieces(vector<seam_piece> &pieces, const vector<ILineSegment> &lineSegments, const cv::Rect &region, bool inside, int tile, bool touching = false)
+{
+    bool pieceOpen = false;
+    int curEdgeSeg = -1;
+    for (auto &segment : lineSegments)
+    {
+        cv::Point midpoint(int(floor((segment.sx + segment.ex) / 2.0)), int(floor((segment.sy + segment.ey) / 2.0)));
+        bool isInside = touching ? isTouchingRegion(segment, region) : region.contains(midpoint);
+        if (isInside != inside)
+        {
+            pieceOpen = false;
+            continue;
+        }
+
+        if (!pieceOpen || segment.segmentNo != curEdgeSeg)
+        {
+            seam_piece piece;
+            piece.tile = tile;
+            pieces.push_back(piece);
+            curEdgeSeg = segment.segmentNo;
+            pieceOpen = true;
+        }
+        pieces.back().lines.push_back(segment);
+    }
+}
+
+// joins the pieces of a chain, given in walk order. the lines of a piece
+// point the way its tile traced them, against the walk when the piece was
+// entered from its back. a single line has no back, it is walked against
+// its direction when its end touches the previous piece. the chain then
+// runs the way most of it was traced, like whole-image detection returns
+// it, and every line is turned to point along it
+static vector<ILineSegment> orientPieces(vector<vector<ILineSegment>> &walked, vector<bool> &backward, vector<bool> &mergePrev)
+{
+    for (size_t k = 0; k < walked.size(); k++)
+    {
+        if (walked[k].size() > 1)
+        {
+            continue;
+        }
+
+        const ILineSegment &seg = walked[k].front();
+        if (k > 0)
+        {
+            const ILineSegment &prev = walked[k - 1].back();
+            double px = backward[k - 1] ? prev.sx : prev.ex;
+            double py = backward[k - 1] ? prev.sy : prev.ey;
+            backward[k] = hypot(seg.ex - px, seg.ey - py) < hypot(seg.sx - px, seg.sy - py);
+        }
+        else if (walked.size() > 1)
+        {
+            // the end closest to the next piece is where the walk leaves
+            const ILineSegment &next = walked[1].front();
+            double startDist = min(hypot(seg.sx - next.sx, seg.sy - next.sy), hypot(seg.sx - next.ex, seg.sy - next.ey));
+            double endDist = min(hypot(seg.ex - next.sx, seg.ey - next.sy), hypot(seg.ex - next.ex, seg.ey - next.ey));
+            backward[k] = startDist < endDist;
+        }
+        else
+        {
+            backward[k] = false;
+        }
+    }
+
+    double totalLength = 0.0, backwardLength = 0.0;
+    for (size_t k = 0; k < walked.size(); k++)
+    {
+        for (auto &segment : walked[k])
+        {
+            totalLength += getLineLength(segment);
+            backwardLength += backward[k] ? getLineLength(segment) : 0.0;
+        }
+    }
+    if (2.0 * backwardLength > totalLength)
+    {
+        reverse(walked.begin(), walked.end());
+        reverse(backward.begin(), backward.end());
+        for (size_t k = 0; k < walked.size(); k++)
+        {
+            reverse(walked[k].begin(), walked[k].end());
+            backward[k] = !backward[k];
+        }
+        // the seam before a piece is now the one after it
+        reverse(mergePrev.begin() + 1, mergePrev.end());
+    }
+
+    vector<ILineSegment> chain;
+    for (size_t k = 0; k < walked.size(); k++)
+    {
+        if (backward[k])
+        {
+            for (auto &segment : walked[k])
+            {
+                swap(segment.sx, segment.ex);
+                swap(segment.sy, segment.ey);
+            }
+        }
+
+        size_t first = 0;
+        if (mergePrev[k] && !chain.empty())
+        {
+            ILineSegment merged = mergeCollinear(chain.back(), walked[k].front());
+            chain.pop_back();
+            chain.push_back(merged);
+            first = 1;
+        }
+        chain.insert(chain.end(), walked[k].begin() + first, walked[k].end());
+    }
+
+    return chain;
+}
+
+// pairs the piece ends near a seam with ends from other tiles and walks
+// the joined pieces into renumbered chains
+static LineSegmentList joinSeamPieces(const vector<seam_piece> &pieces, const vector<int> &seamsX, const vector<int> &seamsY, double seamDistThres)
+{
+    // only piece ends close to a seam can continue in another tile
+    vector<int> seamEnds;
+    for (int end = 0; end < 2 * (int)pieces.size(); end++)
+    {
+        const vector<ILineSegment> &lines = pieces[end / 2].lines;
+        const ILineSegment &segment = (end % 2 == 0) ? lines.front() : lines.back();
+        double seamDist = numeric_limits<double>::max();
+        for (int x : seamsX)
+        {
+            seamDist = min(seamDist, min(abs(segment.sx - x), abs(segment.ex - x)));
+        }
+        for (int y : seamsY)
+        {
+            seamDist = min(seamDist, min(abs(segment.sy - y), abs(segment.ey - y)));
+        }
+        if (seamDist <= seamDistThres)
+        {
+            seamEnds.push_back(end);
+        }
+    }
+
+    // collinear continuations first, then plain chain joins, best first
+    vector<seam_match> candidates;
+    for (size_t i = 0; i < seamEnds.size(); i++)
+    {
+        for (size_t j = i + 1; j < seamEnds.size(); j++)
+        {
+            const seam_piece &piece1 = pieces[seamEnds[i] / 2];
+            const seam_piece &piece2 = pieces[seamEnds[j] / 2];
+            if (piece1.tile == piece2.tile)
+            {
+                continue;
+            }
+
+            const ILineSegment &seg1 = (seamEnds[i] % 2 == 0) ? piece1.lines.front() : piece1.lines.back();
+            const ILineSegment &seg2 = (seamEnds[j] % 2 == 0) ? piece2.lines.front() : piece2.lines.back();
+            seam_match match;
+            match.end1 = seamEnds[i];
+            match.end2 = seamEnds[j];
+            if (getAxisAngleDifference(seg1, seg2) <= SEAM_ANGLE_THRES && isCollinear(seg1, seg2, match.score))
+            {
+                match.collinear = true;
+                candidates.push_back(match);
+                continue;
+            }
+
+            match.score = getEndpointDistance(seg1, seg2);
+            if (match.score <= SEAM_JOIN_DIST)
+            {
+                match.collinear = false;
+                candidates.push_back(match);
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end(), [](const seam_match &m1, const seam_match &m2) {
+        return (m1.collinear != m2.collinear) ? m1.collinear : m1.score < m2.score;
+    });
+
+    vector<int> partner(2 * pieces.size(), -1);
+    vector<bool> collinear(2 * pieces.size(), false);
+    for (auto &match : candidates)
+    {
+        if (partner[match.end1] >= 0 || partner[match.end2] >= 0)
+        {
+            continue;
+        }
+        partner[match.end1] = match.end2;
+        partner[match.end2] = match.end1;
+        collinear[match.end1] = collinear[match.end2] = match.collinear;
+    }
+
+    // walk the joined pieces, open chains from their free end first,
+    // then what is left are closed loops
+    LineSegmentList segments;
+    vector<bool> visited(pieces.size(), false);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int start = 0; start < (int)pieces.size(); start++)
+        {
+            if (visited[start] || (pass == 0 && partner[2 * start] >= 0 && partner[2 * start + 1] >= 0))
+            {
+                continue;
+            }
+
+            // collect the pieces in walk order first, which way their
+            // lines have to point is only known for the whole chain
+            vector<vector<ILineSegment>> walked;
+            vector<bool> backward, mergePrev;
+            int entry = (pass == 0 && partner[2 * start] >= 0) ? 2 * start + 1 : 2 * start;
+            bool mergeFirst = false;
+            while (entry >= 0 && !visited[entry / 2])
+            {
+                int p = entry / 2;
+                visited[p] = true;
+                walked.push_back(pieces[p].lines);
+                if (entry % 2 == 1)
+                {
+                    reverse(walked.back().begin(), walked.back().end());
+                }
+                backward.push_back(entry % 2 == 1);
+                mergePrev.push_back(mergeFirst);
+
+                int exit = entry ^ 1;
+                mergeFirst = collinear[exit];
+                entry = partner[exit];
+            }
+
+            // a loop closing on a collinear seam starts and ends on the same line
+            vector<ILineSegment> chain = orientPieces(walked, backward, mergePrev);
+            if (entry >= 0 && mergeFirst && chain.size() > 1)
+            {
+                chain.front() = mergeCollinear(chain.front(), chain.back());
+                chain.pop_back();
+            }
+
+            if (chain.size() < 2)
+            {
+                continue;
+            }
+            for (auto &segment : chain)
+            {
+                segment.segmentNo = (int)segments.size();
+            }
+            segments.push_back(chain);
+        }
+    }
+
+    return segments;
+}
+
+segment_agreement compareLineSegments(const LineSegmentList &reference, const LineSegmentList &other, double tolerance)
+{
+    segment_agreement rv = {0, 0, 0, 0, 0, 0, 0, 0};
+    vector<bool> otherMatched;
+    vector<int> otherChain;
+    vector<const ILineSegment *> otherLines;
+    for (size_t i = 0; i < other.size(); i++)
+    {
+        for (const ILineSegment &seg : other[i])
+        {
+            otherLines.push_back(&seg);
+            otherChain.push_back((int)i);
+        }
+    }
+    otherMatched.resize(otherLines.size(), false);
+
+    for (const vector<ILineSegment> &chain : reference)
+    {
+        int chainMatch = -1;
+        bool chainAgrees = !chain.empty();
+        for (const ILineSegment &seg : chain)
+        {
+            int match = -1;
+            for (size_t j = 0; j < otherLines.size() && match < 0; j++)
+            {
+                if (isSameLine(seg, *otherLines[j], tolerance))
+                {
+                    match = (int)j;
+                }
+            }
+
+            rv.referenceLines++;
+            if (match < 0)
+            {
+                chainAgrees = false;
+                continue;
+            }
+            rv.matchedLines++;
+            otherMatched[match] = true;
+            if (isSameFit(seg, *otherLines[match], tolerance))
+            {
+                rv.matchedFits++;
+            }
+            if ((seg.ex - seg.sx) * (otherLines[match]->ex - otherLines[match]->sx) + (seg.ey - seg.sy) * (otherLines[match]->ey - otherLines[match]->sy) > 0.0)
+            {
+                rv.matchedDirections++;
+            }
+
+            if (chainMatch < 0)
+            {
+                chainMatch = otherChain[match];
+            }
+            else if (chainMatch != otherChain[match])
+            {
+                chainAgrees = false;
+            }
+        }
+
+        rv.referenceChains++;
+        if (chainAgrees)
+        {
+            rv.matchedChains++;
+        }
+    }
+
+    rv.otherLines = (int)otherLines.size();
+    rv.otherMatchedLines = (int)count(otherMatched.begin(), otherMatched.end(), true);
+
+    return rv;
+}
+
+void DistortionRectifier::setDetectionTiles(int tilesX, int tilesY, int overlap)
+{
+    if (tilesX < 1 || tilesY < 1)
+    {
+        throw runtime_error("number of tiles must be positive");
+    }
+    if (overlap < 0)
+    {
+        throw runtime_error("tile overlap can't be negative");
+    }
+
+    MatlabEnginePool::instance().reserve(tilesX * tilesY - 1);
+
+    m_tilesX = tilesX;
+    m_tilesY = tilesY;
+    m_tileOverlap = overlap;
+}
+
+LineSegmentList DistortionRectifier::mGetTiledLineSegments()
+{
+    int cols = m_curGrayImage.cols;
+    int rows = m_curGrayImage.rows;
+    vector<cv::Rect> cores, tiles;
+    vector<int> seamsX, seamsY;
+    for (int ty = 0; ty < m_tilesY; ty++)
+    {
+        for (int tx = 0; tx < m_tilesX; tx++)
+        {
+            int x0 = cols * tx / m_tilesX;
+            int y0 = rows * ty / m_tilesY;
+            int x1 = cols * (tx + 1) / m_tilesX;
+            int y1 = rows * (ty + 1) / m_tilesY;
+            cores.push_back(cv::Rect(x0, y0, x1 - x0, y1 - y0));
+            tiles.push_back(cv::Rect(x0 - m_tileOverlap, y0 - m_tileOverlap, x1 - x0 + 2 * m_tileOverlap, y1 - y0 + 2 * m_tileOverlap) &
+                            cv::Rect(0, 0, cols, rows));
+            if (ty == 0 && tx > 0)
+            {
+                seamsX.push_back(x0);
+            }
+            if (tx == 0 && ty > 0)
+            {
+                seamsY.push_back(y0);
+            }
+        }
+    }
+
+    vector<vector<matlab::data::Array>> args;
+    for (auto &tile : tiles)
+    {
+        vector<matlab::data::Array> tileArgs;
+        tileArgs.push_back(getMatlabImage(m_curGrayImage(tile)));
+        tileArgs.push_back(m_arrayFactory.createScalar<int>(tile.height));
+        tileArgs.push_back(m_arrayFactory.createScalar<int>(tile.width));
+        args.push_back(tileArgs);
+    }
+    vector<matlab::data::Array> results = mFevalTiles("EDPFLinesmex", args);
+
+    // every line is kept by the tile whose core holds its midpoint
+    vector<seam_piece> pieces;
+    for (int t = 0; t < (int)tiles.size(); t++)
+    {
+        matlab::data::TypedArray<double> temp = results[t];
+        vector<ILineSegment> lineSegments = mParseLineSegments(temp);
+        for (auto &segment : lineSegments)
+        {
+            shiftLineSegment(segment, tiles[t].tl());
+        }
+        appendPieces(pieces, lineSegments, cores[t], true, t);
+    }
+
+    return joinSeamPieces(pieces, seamsX, seamsY, m_tileOverlap);
+}
+
+void DistortionRectifier::setIncrementalDetection(bool enabled, int refreshInterval)
+{
+    if (refreshInterval < 0)
+    {
+        throw runtime_error("refresh interval must not be negative");
+    }
+
+    m_incremental = enabled;
+    m_refreshInterval = refreshInterval;
+    m_framesSinceFull = 0;
+    m_incrementalStatus = incremental_status();
+    m_refGrayImage.release();
+    m_prevSegments.clear();
+}
+
+incremental_status DistortionRectifier::getIncrementalStatus()
+{
+    return m_incrementalStatus;
+}
+
+LineSegmentList DistortionRectifier::mGetIncrementalLineSegments()
+{
+    LineSegmentList segments = mDetectChangedLineSegments();
+    m_incrementalStatus.framesSinceFull = m_framesSinceFull;
+    if (m_incrementalStatus.update == UPDATE_FULL || m_refreshInterval == 0 || m_framesSinceFull < m_refreshInterval)
+    {
+        return segments;
+    }
+
+    // the periodic full detection bounds how long carried lines can drift,
+    // and the incremental result of the same frame tells by how much
+    LineSegmentList reference = mDetectLineSegments();
+    segment_agreement agreement = compareLineSegments(reference, segments);
+    double matched = (agreement.referenceLines > 0) ? double(agreement.matchedLines) / agreement.referenceLines : 1.0;
+    double otherMatched = (agreement.otherLines > 0) ? double(agreement.otherMatchedLines) / agreement.otherLines : 1.0;
+    m_incrementalStatus.update = UPDATE_REFRESH;
+    m_incrementalStatus.region = cv::Rect();
+    m_incrementalStatus.agreement = agreement;
+    m_incrementalStatus.diverged = min(matched, otherMatched) < INCREMENTAL_MIN_AGREEMENT;
+
+    m_prevSegments = reference;
+    m_refGrayImage = m_curGrayImage.clone();
+    m_framesSinceFull = 0;
+    return m_prevSegments;
+}
+
+LineSegmentList DistortionRectifier::mDetectChangedLineSegments()
+{
+    cv::Rect image(0, 0, m_curGrayImage.cols, m_curGrayImage.rows);
+    cv::Rect core;
+    m_incrementalStatus.region = cv::Rect();
+    if (!m_refGrayImage.empty() && m_refGrayImage.size() == m_curGrayImage.size() && m_refGrayImage.type() == m_curGrayImage.type())
+    {
+        // mean absolute difference of every block against the frame
+        // the current lines were detected on
+        cv::Mat diff, blocks;
+        cv::absdiff(m_curGrayImage, m_refGrayImage, diff);
+        diff.convertTo(diff, CV_32F);
+        cv::Size noBlocks((image.width + CHANGE_BLOCK_SIZE - 1) / CHANGE_BLOCK_SIZE, (image.height + CHANGE_BLOCK_SIZE - 1) / CHANGE_BLOCK_SIZE);
+        cv::resize(diff, blocks, noBlocks, 0, 0, cv::INTER_AREA);
+
+        for (int by = 0; by < blocks.rows; by++)
+        {
+            for (int bx = 0; bx < blocks.cols; bx++)
+            {
+                if (blocks.at<float>(by, bx) > CHANGE_THRES)
+                {
+                    // one block of margin for lines running out of the change
+                    cv::Rect block((bx - 1) * CHANGE_BLOCK_SIZE, (by - 1) * CHANGE_BLOCK_SIZE, 3 * CHANGE_BLOCK_SIZE, 3 * CHANGE_BLOCK_SIZE);
+                    core = core.empty() ? (block & image) : (core | (block & image));
+                }
+            }
+        }
+
+        m_framesSinceFull++;
+        if (core.empty())
+        {
+            m_incrementalStatus.update = UPDATE_NONE;
+            return m_prevSegments;
+        }
+    }
+
+    if (core.empty() || core.area() > INCREMENTAL_MAX_CHANGE * image.area())
+    {
+        m_incrementalStatus.update = UPDATE_FULL;
+        m_prevSegments = mDetectLineSegments();
+        m_refGrayImage = m_curGrayImage.clone();
+        m_framesSinceFull = 0;
+        return m_prevSegments;
+    }
+
+    // re-detect the changed region with some context around it
+    cv::Rect tile(core.x - m_tileOverlap, core.y - m_tileOverlap, core.width + 2 * m_tileOverlap, core.height + 2 * m_tileOverlap);
+    tile = tile & image;
+
+    vector<matlab::data::Array> args;
+    args.push_back(getMatlabImage(m_curGrayImage(tile)));
+    args.push_back(m_arrayFactory.createScalar<int>(tile.height));
+    args.push_back(m_arrayFactory.createScalar<int>(tile.width));
+    matlab::data::TypedArray<double> temp = mFeval("EDPFLinesmex", args);
+
+    vector<ILineSegment> lineSegments = mParseLineSegments(temp);
+    for (auto &segment : lineSegments)
+    {
+        shiftLineSegment(segment, tile.tl());
+    }
+
+    vector<ILineSegment> prevLineSegments;
+    for (auto &chain : m_prevSegments)
+    {
+        prevLineSegments.insert(prevLineSegments.end(), chain.begin(), chain.end());
+    }
+
+    // a line touching the region may have changed anywhere along it, so
+    // only lines clear of it are carried over and the new detection
+    // supplies every line that touches it
+    vector<seam_piece> pieces;
+    appendPieces(pieces, prevLineSegments, core, false, 0, true);
+    appendPieces(pieces, lineSegments, core, true, 1, true);
+
+    vector<int> seamsX, seamsY;
+    if (core.x > 0)
+    {
+        seamsX.push_back(core.x);
+    }
+    if (core.x + core.width < image.width)
+    {
+        seamsX.push_back(core.x + core.width);
+    }
+    if (core.y > 0)
+    {
+        seamsY.push_back(core.y);
+    }
+    if (core.y + core.height < image.height)
+    {
+        seamsY.push_back(core.y + core.height);
+    }
+
+    m_incrementalStatus.update = UPDATE_REGION;
+    m_incrementalStatus.region = core;
+    m_prevSegments = joinSeamPieces(pieces, seamsX, seamsY, m_tileOverlap);
+    cv::Mat refCore = m_refGrayImage(core);
+    m_curGrayImage(core).copyTo(refCore);
+    return m_prevSegments;
+}
+
+} // namespace distrect
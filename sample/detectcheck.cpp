@@ -0,0 +1,194 @@
+#include <iostream>
+#include <string>
+#include <libdistrect.hpp>
+#include <opencv2/opencv.hpp>
+
+// agreement of the tiled run with whole-image detection over all images
+// below which `detectcheck tiles` fails
+const double MIN_LINE_AGREEMENT = 0.9;
+const double MIN_CHAIN_AGREEMENT = 0.8;
+const double MIN_DIRECTION_AGREEMENT = 0.95;
+// of the whole-image line groups that cross a seam and whose lines were
+// all detected by the tiled run too
+const double MIN_SEAM_GROUP_AGREEMENT = 0.75;
+
+static void printAgreement(const distrect::segment_agreement &agreement)
+{
+	std::cout << "lines " << agreement.matchedLines << "/" << agreement.referenceLines
+			  << ", extra " << agreement.otherLines - agreement.otherMatchedLines
+			  << ", chains " << agreement.matchedChains << "/" << agreement.referenceChains
+			  << ", fits " << agreement.matchedFits << "/" << agreement.matchedLines
+			  << ", directions " << agreement.matchedDirections << "/" << agreement.matchedLines;
+}
+
+static bool checkRatio(const std::string &name, int matched, int total, double threshold)
+{
+	double ratio = (total > 0) ? double(matched) / total : 1.0;
+	bool passed = ratio >= threshold;
+	std::cout << name << ": " << matched << "/" << total << " = " << ratio
+			  << (passed ? " >= " : " < ") << threshold << (passed ? "" : " FAILED") << std::endl;
+	return passed;
+}
+
+static distrect::LineSegmentList getLineGroups(distrect::DistortionRectifier &dr, const distrect::LineSegmentList &segments)
+{
+	distrect::LineSegmentList filteredSegments = segments.empty() ? segments : dr.filterLineSegments(segments);
+	return filteredSegments.empty() ? filteredSegments : dr.groupLineSegments(filteredSegments);
+}
+
+static bool isCrossingSeam(const std::vector<distrect::ILineSegment> &group, const std::vector<int> &seamsX, const std::vector<int> &seamsY)
+{
+	double minX = group.front().sx, maxX = minX, minY = group.front().sy, maxY = minY;
+	for (auto &seg : group)
+	{
+		minX = std::min(minX, std::min(seg.sx, seg.ex));
+		maxX = std::max(maxX, std::max(seg.sx, seg.ex));
+		minY = std::min(minY, std::min(seg.sy, seg.ey));
+		maxY = std::max(maxY, std::max(seg.sy, seg.ey));
+	}
+	for (int x : seamsX)
+	{
+		if (minX < x && x < maxX)
+			return true;
+	}
+	for (int y : seamsY)
+	{
+		if (minY < y && y < maxY)
+			return true;
+	}
+	return false;
+}
+
+// detect every image on the whole image and in tiles, compare the tiled
+// lines, chains and line groups with the whole-image ones and fail when
+// they agree less than the thresholds above
+static int checkTiles(int tilesX, int tilesY, int argc, char **argv)
+{
+	distrect::DistortionRectifier whole, tiled;
+	tiled.setDetectionTiles(tilesX, tilesY);
+
+	distrect::segment_agreement total = {0, 0, 0, 0, 0, 0, 0, 0};
+	int seamGroups = 0, matchedSeamGroups = 0;
+	double totalTime[2] = {0.0, 0.0};
+	for (int i = 0; i < argc; i++)
+	{
+		cv::Mat image = cv::imread(argv[i]);
+		if (image.empty())
+		{
+			std::cout << argv[i] << ": not an image, skipped" << std::endl;
+			continue;
+		}
+		whole.setImage(image);
+		tiled.setImage(image);
+
+		double t = (double)cv::getTickCount();
+		distrect::LineSegmentList reference = whole.getLineSegments();
+		double wholeTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+		t = (double)cv::getTickCount();
+		distrect::LineSegmentList segments = tiled.getLineSegments();
+		double tiledTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+		distrect::segment_agreement agreement = distrect::compareLineSegments(reference, segments);
+		total.matchedLines += agreement.matchedLines;
+		total.referenceLines += agreement.referenceLines;
+		total.otherMatchedLines += agreement.otherMatchedLines;
+		total.otherLines += agreement.otherLines;
+		total.matchedChains += agreement.matchedChains;
+		total.referenceChains += agreement.referenceChains;
+		total.matchedFits += agreement.matchedFits;
+		total.matchedDirections += agreement.matchedDirections;
+
+		// a chain cut by a seam has to group the same way as without tiles
+		std::vector<int> seamsX, seamsY;
+		for (int tx = 1; tx < tilesX; tx++)
+			seamsX.push_back(image.cols * tx / tilesX);
+		for (int ty = 1; ty < tilesY; ty++)
+			seamsY.push_back(image.rows * ty / tilesY);
+		distrect::LineSegmentList referenceGroups = getLineGroups(whole, reference);
+		distrect::LineSegmentList groups = getLineGroups(tiled, segments);
+		distrect::LineSegmentList crossingGroups;
+		for (auto &group : referenceGroups)
+		{
+			distrect::LineSegmentList single(1, group);
+			if (isCrossingSeam(group, seamsX, seamsY) && distrect::compareLineSegments(single, segments).matchedLines == (int)group.size())
+				crossingGroups.push_back(group);
+		}
+		distrect::segment_agreement groupAgreement = distrect::compareLineSegments(crossingGroups, groups);
+		seamGroups += groupAgreement.referenceChains;
+		matchedSeamGroups += groupAgreement.matchedChains;
+
+		totalTime[0] += wholeTime;
+		totalTime[1] += tiledTime;
+		std::cout << argv[i] << ": ";
+		printAgreement(agreement);
+		std::cout << ", seam groups " << groupAgreement.matchedChains << "/" << groupAgreement.referenceChains
+				  << ", time (s) " << wholeTime << " / " << tiledTime << std::endl;
+	}
+
+	std::cout << "time whole: " << totalTime[0] << ", tiled: " << totalTime[1] << std::endl;
+	bool passed = checkRatio("lines", total.matchedLines, total.referenceLines, MIN_LINE_AGREEMENT);
+	passed = checkRatio("chains", total.matchedChains, total.referenceChains, MIN_CHAIN_AGREEMENT) && passed;
+	passed = checkRatio("directions", total.matchedDirections, total.matchedLines, MIN_DIRECTION_AGREEMENT) && passed;
+	passed = checkRatio("seam groups", matchedSeamGroups, seamGroups, MIN_SEAM_GROUP_AGREEMENT) && passed;
+	return passed ? 0 : 1;
+}
+
+// detect every frame of a sequence incrementally and in full, and compare
+// the incremental lines with the full ones. the periodic refresh is
+// disabled so that drift is not hidden by it
+static int checkIncremental(int argc, char **argv)
+{
+	distrect::DistortionRectifier full, incremental;
+	incremental.setIncrementalDetection(true, 0);
+
+	double totalTime[2] = {0.0, 0.0};
+	double worst = 1.0;
+	for (int i = 0; i < argc; i++)
+	{
+		cv::Mat image = cv::imread(argv[i]);
+		full.setImage(image);
+		incremental.setImage(image);
+
+		double t = (double)cv::getTickCount();
+		distrect::LineSegmentList reference = full.getLineSegments();
+		double fullTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+		t = (double)cv::getTickCount();
+		distrect::LineSegmentList segments = incremental.getLineSegments();
+		double incrementalTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+		distrect::segment_agreement agreement = distrect::compareLineSegments(reference, segments);
+		if (agreement.referenceLines > 0)
+		{
+			worst = std::min(worst, double(agreement.matchedLines) / agreement.referenceLines);
+		}
+		totalTime[0] += fullTime;
+		totalTime[1] += incrementalTime;
+		static const char *updates[] = {"none", "region", "full", "refresh"};
+		distrect::incremental_status status = incremental.getIncrementalStatus();
+		std::cout << "frame " << i << " (" << updates[status.update] << ", " << status.region.area() << " px): ";
+		printAgreement(agreement);
+		std::cout << ", time (s) " << fullTime << " / " << incrementalTime << std::endl;
+	}
+
+	std::cout << "worst line agreement: " << worst << ", time full: " << totalTime[0] << ", incremental: " << totalTime[1] << std::endl;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	std::string mode = (argc > 1) ? argv[1] : "";
+	if (mode == "tiles" && argc >= 5)
+	{
+		return checkTiles(std::stoi(argv[2]), std::stoi(argv[3]), argc - 4, argv + 4);
+	}
+	if (mode == "incremental" && argc >= 3)
+	{
+		return checkIncremental(argc - 2, argv + 2);
+	}
+
+	std::cout << "usage: detectcheck tiles <tilesX> <tilesY> <image> [<image> ...]" << std::endl
+			  << "       detectcheck incremental <frame> [<frame> ...]" << std::endl;
+	return 1;
+}
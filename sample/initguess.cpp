@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <libdistrect.hpp>
+#include <opencv2/opencv.hpp>
+
+// calibrate every image cold and seeded, and compare the GetFMin cost
+// evaluations, the final error and the time
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cout << "usage: initguess <image> [<image> ...]" << std::endl;
+		return 1;
+	}
+
+	distrect::DistortionRectifier dr;
+	long totalEvaluations[2] = {0, 0};
+	for (int i = 1; i < argc; i++)
+	{
+		dr.setImage(std::string(argv[i]));
+		distrect::LineSegmentList segments = dr.getLineSegments();
+		distrect::LineSegmentList groupSegments = dr.groupLineSegments(dr.filterLineSegments(segments));
+
+		std::cout << argv[i] << std::endl;
+		for (int seeded = 0; seeded < 2; seeded++)
+		{
+			// also drops the warm start of the previous image
+			dr.setInitialGuess(seeded == 1);
+			dr.resetCostEvaluationCount();
+
+			double t = (double)cv::getTickCount();
+			distrect::LineSegmentList finalSegments = dr.selectLineSegmentGroups(groupSegments);
+			distrect::camera_props props = dr.getCameraParams(finalSegments);
+			t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+			totalEvaluations[seeded] += dr.getCostEvaluationCount();
+			std::cout << (seeded ? "  seeded: " : "  cold:   ")
+					  << "evaluations " << dr.getCostEvaluationCount()
+					  << ", groups " << finalSegments.size()
+					  << ", error " << distrect::getLineGroupsError(finalSegments, props)
+					  << ", k " << props.distortion_params.at<float>(0, 0) << " " << props.distortion_params.at<float>(0, 1)
+					  << ", time (s) " << t << std::endl;
+		}
+	}
+
+	std::cout << "evaluations cold: " << totalEvaluations[0] << ", seeded: " << totalEvaluations[1] << std::endl;
+	return 0;
+}
@@ -32,6 +32,7 @@ int main(int argc, char **argv)
 	std::cout << "Time taken for calibration & distortion estimation in seconds: " << t1 << std::endl;
 	std::cout << props.intrinsic_matrix << std::endl;
 	std::cout << props.distortion_params << std::endl;
+	std::cout << "cost evaluations: " << dr.getCostEvaluationCount() << std::endl;
 	double t2 = (double)getTickCount();
 	cv::Mat img = dr.undistort(props,0);
 	t2 = ((double)getTickCount() - t2) / getTickFrequency();
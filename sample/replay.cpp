@@ -0,0 +1,37 @@
+#include <iostream>
+#include <string>
+#include <libdistrect.hpp>
+#include <pipelinerecord.hpp>
+#include <opencv2/opencv.hpp>
+
+// record with DistortionRectifier::setRecorder, then re-run the grouping
+// stage on every recorded frame without images, detection or a MATLAB
+// engine
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cout << "usage: replay <record file>" << std::endl;
+		return 1;
+	}
+
+	distrect::PipelineReplay replay(argv[1]);
+	distrect::DistortionRectifier dr;
+	double recorded = 0.0, replayed = 0.0;
+	for (int frame = 0; frame < replay.getFrameCount(); frame++)
+	{
+		if (!replay.hasStage(frame, distrect::STAGE_FILTER))
+			continue;
+
+		dr.setImageSize(replay.getImageSize(frame));
+		distrect::LineSegmentList filteredSegments = replay.getSegments(frame, distrect::STAGE_FILTER);
+		double t = (double)cv::getTickCount();
+		distrect::LineSegmentList groupSegments = dr.groupLineSegments(filteredSegments);
+		replayed += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+		recorded += std::max(replay.getTiming(frame, distrect::STAGE_GROUP), 0.0);
+	}
+
+	std::cout << "frames: " << replay.getFrameCount() << std::endl;
+	std::cout << "grouping recorded (s): " << recorded << ", replayed (s): " << replayed << std::endl;
+	return 0;
+}
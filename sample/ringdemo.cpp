@@ -0,0 +1,95 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <libdistrect.hpp>
+#include <framering.hpp>
+#include <opencv2/opencv.hpp>
+
+// run "ringdemo produce" and one or more "ringdemo consume" side by side.
+// "ringdemo synthetic" produces without MATLAB or the video.
+const std::string RING_NAME = "/distrect_ring";
+const std::string INPUT_IMAGE = "../../images/000931.jpg";
+const std::string INPUT_VIDEO = "wide.mp4";
+
+static int produce()
+{
+	distrect::DistortionRectifier dr;
+	dr.setImage(INPUT_IMAGE);
+	distrect::LineSegmentList segments = dr.getLineSegments();
+	segments = dr.filterLineSegments(segments);
+	segments = dr.groupLineSegments(segments);
+	segments = dr.selectLineSegmentGroups(segments);
+	distrect::camera_props props = dr.getCameraParams(segments);
+
+	cv::VideoCapture cap(INPUT_VIDEO);
+	cv::Mat frame;
+	cap >> frame;
+	if (frame.empty())
+		return 1;
+
+	distrect::FrameRingWriter ring(RING_NAME, frame.size(), frame.type());
+	while (!frame.empty())
+	{
+		dr.setImage(frame);
+		cv::Mat slot = ring.beginWrite();
+		dr.undistort(props, slot, 0);
+		ring.commit((int64_t)cv::getTickCount());
+		cap >> frame;
+	}
+	return 0;
+}
+
+// a grid scrolling one pixel per frame and the frame number, at 30 fps
+static int produceSynthetic()
+{
+	const cv::Size size(640, 480);
+	const int numFrames = 900;
+	const int cell = 32;
+
+	distrect::FrameRingWriter ring(RING_NAME, size, CV_8UC3);
+	for (int i = 0; i < numFrames; i++)
+	{
+		cv::Mat slot = ring.beginWrite();
+		slot.setTo(cv::Scalar(40, 40, 40));
+		for (int x = i % cell; x < size.width; x += cell)
+			cv::line(slot, cv::Point(x, 0), cv::Point(x, size.height - 1), cv::Scalar(200, 200, 200));
+		for (int y = i % cell; y < size.height; y += cell)
+			cv::line(slot, cv::Point(0, y), cv::Point(size.width - 1, y), cv::Scalar(200, 200, 200));
+		cv::putText(slot, std::to_string(i + 1), cv::Point(20, 60), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(0, 255, 255), 2);
+		ring.commit((int64_t)cv::getTickCount());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(33));
+	}
+	return 0;
+}
+
+static int consume()
+{
+	distrect::FrameRingReader ring(RING_NAME);
+	uint64_t last = 0;
+	while (1)
+	{
+		distrect::frame_view view;
+		if (ring.getPublishedSequence() != last && ring.acquire(0, view))
+		{
+			cv::imshow("UNDISTORTED", view.image);
+			if (!ring.validate(view))
+				std::cout << "frame " << view.sequence << " was overwritten while shown" << std::endl;
+			last = view.sequence;
+		}
+		char c = (char)cv::waitKey(5);
+		if (c == 27)
+			break;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && std::string(argv[1]) == "consume")
+		return consume();
+	if (argc > 1 && std::string(argv[1]) == "synthetic")
+		return produceSynthetic();
+	return produce();
+}